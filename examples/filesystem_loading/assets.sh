@@ -10,4 +10,5 @@ python3 $TOOLS/md5_to_dsma.py \
     --texture 128 128 \
     --anim $ROBOT/Walk.md5anim \
     --skip-frames 1 \
-    --blender-fix
+    --blender-fix \
+    --container
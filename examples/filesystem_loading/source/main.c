@@ -118,14 +118,28 @@ int main(void)
         }
     }
 
-    // Load files from the filesystem
-    void *texture128, *dsa_file, *dsm_file;
-    size_t texture128_size, dsa_file_size, dsm_file_size;
+    // Load files from the filesystem. The model and its animation are stored in
+    // a container, so they can be loaded with just one read.
+    void *texture128, *container;
+    size_t texture128_size, container_size;
 
     int ret = 0;
-    ret |= file_load("robot.dsm", &dsm_file, &dsm_file_size);
-    ret |= file_load("robot_walk.dsa", &dsa_file, &dsa_file_size);
+    ret |= file_load("robot.dsmc", &container, &container_size);
     ret |= file_load("texture128.bin", &texture128, &texture128_size);
+
+    const void *dsm_file = NULL;
+    const void *dsa_file = NULL;
+    if (ret == 0)
+    {
+        dsm_file = DSMA_ContainerGetFile(container, "robot.dsm");
+        dsa_file = DSMA_ContainerGetFile(container, "robot_walk.dsa");
+        if ((dsm_file == NULL) || (dsa_file == NULL))
+        {
+            printf("Files not found in the container!\n");
+            ret = -1;
+        }
+    }
+
     if (ret)
     {
         printf("Press START to exit");
@@ -139,9 +153,9 @@ int main(void)
     }
 
     printf("\x1b[20;0HLoaded files:");
-    printf("\x1b[21;0HDSM:     %8zu bytes", dsm_file_size);
-    printf("\x1b[22;0HDSA:     %8zu bytes", dsa_file_size);
-    printf("\x1b[23;0HTexture: %8zu bytes", texture128_size);
+    printf("\x1b[21;0HContainer: %8zu bytes", container_size);
+    printf("\x1b[22;0H  (%lu files)", DSMA_ContainerGetNumFiles(container));
+    printf("\x1b[23;0HTexture:   %8zu bytes", texture128_size);
 
     // Load texture
     int textureID;
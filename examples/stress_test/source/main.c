@@ -155,22 +155,37 @@ void draw_and_update_models(void)
 
         index++;
     }
-    for (int i = 0; i < NUM_WIGGLES; i++)
-    {
-        const void *dsm = wiggle_dsm_bin;
-        const void *dsa = wiggle_shake_dsa_bin;
-        uint32_t frame = model[index].curr_frame_interp;
 
-        glPushMatrix();
+    // All wiggles use the same animation, so they can be drawn as instances.
+    // Their frames are rounded to 1/4 of a frame so that the poses are shared
+    // between as many instances as possible.
+    static DSMA_Instance wiggles[NUM_WIGGLES];
 
-        glTranslatef32(model[index].x, model[index].y, model[index].z);
-        DSMA_DrawModel(dsm, dsa, frame);
-
-        glPopMatrix(1);
+    for (int i = 0; i < NUM_WIGGLES; i++)
+    {
+        DSMA_Instance *inst = &wiggles[i];
+
+        inst->frame_interp = model[index].curr_frame_interp;
+
+        inst->matrix[0] = inttof32(1);
+        inst->matrix[1] = 0;
+        inst->matrix[2] = 0;
+        inst->matrix[3] = 0;
+        inst->matrix[4] = inttof32(1);
+        inst->matrix[5] = 0;
+        inst->matrix[6] = 0;
+        inst->matrix[7] = 0;
+        inst->matrix[8] = inttof32(1);
+        inst->matrix[9] = model[index].x;
+        inst->matrix[10] = model[index].y;
+        inst->matrix[11] = model[index].z;
 
         index++;
     }
 
+    DSMA_DrawModelInstances(wiggle_dsm_bin, wiggle_shake_dsa_bin,
+                            wiggles, NUM_WIGGLES, 10);
+
     for (int i = 0; i < NUM_MODELS; i++)
     {
         model[i].curr_frame_interp += model[i].animation_speed;
@@ -0,0 +1,131 @@
+#!/bin/sh
+
+# SPDX-License-Identifier: MIT
+#
+# Copyright (c) 2022 Antonio Niño Díaz <antonio_nd@outlook.com>
+
+# Usage:
+#
+#   corpus.sh convert <corpus_dir>
+#   corpus.sh dump <corpus_dir> <dumps_dir>
+#   corpus.sh bench <corpus_dir>
+#   corpus.sh microbench <corpus_dir>
+#   corpus.sh check-tracks <work_dir>
+
+set -e
+
+TOOLS=../tools
+MODELS=../models
+PYTHON=${PYTHON:-python3}
+
+# Additional arguments passed to the converter (e.g. "--compact")
+CONVERTER_FLAGS=${CONVERTER_FLAGS:-}
+# Directory of the binaries, set by the Makefile
+BUILDDIR=${BUILDDIR:-build}
+HOST=$BUILDDIR/dsma_host
+BENCH=$BUILDDIR/dsma_bench
+
+# List of "model_name:anim_name" pairs of the corpus
+PAIRS="one_quad:wiggle robot:bow robot:walk robot:wave wiggle:shake"
+
+convert()
+{
+    OUT=$1
+
+    $PYTHON $TOOLS/md5_to_dsma.py \
+        --model $MODELS/one_quad/Quad.md5mesh \
+        --name one_quad \
+        --output $OUT \
+        --texture 128 128 \
+        --anim $MODELS/one_quad/Wiggle.md5anim \
+        --blender-fix $CONVERTER_FLAGS > /dev/null
+
+    $PYTHON $TOOLS/md5_to_dsma.py \
+        --model $MODELS/robot/Robot.md5mesh \
+        --name robot \
+        --output $OUT \
+        --texture 128 128 \
+        --anim $MODELS/robot/Bow.md5anim $MODELS/robot/Walk.md5anim \
+               $MODELS/robot/Wave.md5anim \
+        --blender-fix $CONVERTER_FLAGS > /dev/null
+
+    $PYTHON $TOOLS/md5_to_dsma.py \
+        --model $MODELS/wiggle/Wiggle.md5mesh \
+        --name wiggle \
+        --output $OUT \
+        --texture 128 128 \
+        --anim $MODELS/wiggle/Shake.md5anim \
+        --blender-fix $CONVERTER_FLAGS > /dev/null
+}
+
+dump()
+{
+    IN=$1
+    OUT=$2
+
+    mkdir -p $OUT
+
+    for PAIR in $PAIRS; do
+        MODEL=${PAIR%%:*}
+        ANIM=${PAIR##*:}
+        $HOST --output $OUT/${MODEL}_${ANIM}.txt \
+            $IN/$MODEL.dsm $IN/${MODEL}_${ANIM}.dsa
+    done
+}
+
+bench()
+{
+    IN=$1
+
+    for PAIR in $PAIRS; do
+        MODEL=${PAIR%%:*}
+        ANIM=${PAIR##*:}
+        echo "${MODEL}_${ANIM}:"
+        $HOST --bench 1000 $IN/$MODEL.dsm $IN/${MODEL}_${ANIM}.dsa
+    done
+}
+
+microbench()
+{
+    IN=$1
+    ARGS=""
+
+    for PAIR in $PAIRS; do
+        MODEL=${PAIR%%:*}
+        ANIM=${PAIR##*:}
+        ARGS="$ARGS $IN/$MODEL.dsm $IN/${MODEL}_${ANIM}.dsa"
+    done
+
+    $BENCH $ARGS
+}
+
+# DSA files with tracks exported with a tolerance of 0 keep all the frames that
+# can't be interpolated exactly, so they must be drawn like compact DSA files
+# (which use the same 16-bit values), including fractional frames.
+check_tracks()
+{
+    DIR=$1
+
+    CONVERTER_FLAGS="--compact"
+    convert $DIR/compact
+    CONVERTER_FLAGS="--keyframe-tolerance 0"
+    convert $DIR/tracks
+
+    dump $DIR/compact $DIR/compact_dumps
+    dump $DIR/tracks $DIR/tracks_dumps
+
+    diff -r $DIR/compact_dumps $DIR/tracks_dumps
+    echo "Tracks match compact files"
+}
+
+CMD=$1
+shift
+
+case $CMD in
+    convert) convert "$@" ;;
+    dump) dump "$@" ;;
+    bench) bench "$@" ;;
+    microbench) microbench "$@" ;;
+    check-tracks) check_tracks "$@" ;;
+    *) echo "Unknown command: $CMD"; exit 1 ;;
+esac
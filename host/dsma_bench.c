@@ -0,0 +1,476 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2022 Antonio Niño Díaz <antonio_nd@outlook.com>
+
+// Micro-benchmarks of the math of DSMA. It measures the kernels used to
+// calculate the matrices of the joints, and the evaluation of full poses of
+// models, and it prints the results as CSV so that they can be compared across
+// versions of the library.
+//
+// The kernels are private functions of the library, so the library is built as
+// part of this file instead of being linked.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "dsma.c"
+
+// Max number of model/animation pairs passed in the command line.
+#define MAX_PAIRS 32
+
+// Number of joints used to run the kernels.
+static const uint32_t kernel_joints[] = { 1, 16, 30 };
+#define NUM_KERNEL_JOINT_COUNTS (sizeof(kernel_joints) / sizeof(kernel_joints[0]))
+
+// Minimum time that each benchmark runs for.
+static uint64_t min_time_ns = 50000000;
+
+// All results are added here so that the compiler can't remove the kernels.
+static volatile int32_t sink;
+
+static void usage(const char *name)
+{
+    printf("Usage: %s [options] [model.dsm anim.dsa]...\n"
+           "\n"
+           "Runs the benchmarks of the kernels of the library, and the ones of\n"
+           "full poses of all the provided models, and prints the results as\n"
+           "CSV: benchmark, mode, joints, ns per joint and ns per pose.\n"
+           "\n"
+           "Options:\n"
+           "  --min-time MS         Run each benchmark for at least MS\n"
+           "                        milliseconds (default: 50).\n",
+           name);
+}
+
+static void *file_load(const char *filename)
+{
+    FILE *f = fopen(filename, "rb");
+    if (f == NULL)
+    {
+        fprintf(stderr, "%s couldn't be opened!\n", filename);
+        return NULL;
+    }
+
+    fseek(f, 0, SEEK_END);
+    size_t size = ftell(f);
+    rewind(f);
+
+    void *buffer = calloc(1, size + sizeof(uint32_t));
+    if (buffer == NULL)
+    {
+        fprintf(stderr, "Not enough memory to load %s!\n", filename);
+        fclose(f);
+        return NULL;
+    }
+
+    if (fread(buffer, 1, size, f) != size)
+    {
+        fprintf(stderr, "Error while reading %s!\n", filename);
+        fclose(f);
+        free(buffer);
+        return NULL;
+    }
+
+    fclose(f);
+
+    return buffer;
+}
+
+static uint64_t time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+typedef void (*bench_fn)(void *arg);
+
+// Calls the function as many times as needed to run for at least min_time_ns
+// and returns the average time of one call in nanoseconds.
+static double bench_run(bench_fn fn, void *arg)
+{
+    uint64_t iterations = 1;
+
+    // Warm up caches and branch predictors
+    fn(arg);
+
+    while (1)
+    {
+        uint64_t start = time_ns();
+
+        for (uint64_t i = 0; i < iterations; i++)
+            fn(arg);
+
+        uint64_t elapsed = time_ns() - start;
+        if (elapsed >= min_time_ns)
+            return (double)elapsed / iterations;
+
+        iterations *= 2;
+    }
+}
+
+static void print_result(const char *benchmark, const char *mode,
+                         uint32_t num_joints, double ns_per_pose)
+{
+    printf("%s,%s,%u,%.2f,%.2f\n", benchmark, mode, num_joints,
+           ns_per_pose / num_joints, ns_per_pose);
+}
+
+// Kernels
+// -------
+
+// Input of the kernels: two frames with random joints.
+typedef struct {
+    uint32_t num_joints;
+    int32_t pos[2][DSMA_MAX_JOINTS][3];
+    int32_t orient[2][DSMA_MAX_JOINTS][4];
+    int32_t interp;
+} kernel_args_t;
+
+static uint32_t random_state = 12345;
+
+static int32_t random_value(int32_t min, int32_t max)
+{
+    random_state = random_state * 1664525 + 1013904223;
+    return min + (int32_t)((random_state >> 8) % (uint32_t)(max - min + 1));
+}
+
+static void kernel_args_init(kernel_args_t *args, uint32_t num_joints)
+{
+    args->num_joints = num_joints;
+    args->interp = inttof32(1) / 3;
+
+    for (int f = 0; f < 2; f++)
+    {
+        for (uint32_t i = 0; i < num_joints; i++)
+        {
+            for (int c = 0; c < 3; c++)
+                args->pos[f][i][c] = random_value(-inttof32(8), inttof32(8));
+
+            // Random orientation, normalized with the exact method
+            for (int c = 0; c < 4; c++)
+                args->orient[f][i][c] = random_value(-inttof32(1), inttof32(1));
+
+            DSMA_SetInterpolationQuality(DSMA_INTERPOLATION_NORMALIZED_EXACT);
+            q_normalize(args->orient[f][i]);
+            DSMA_SetInterpolationQuality(DSMA_INTERPOLATION_FAST);
+        }
+    }
+}
+
+static void kernel_lerp(void *arg)
+{
+    kernel_args_t *args = arg;
+    int32_t acc = 0;
+
+    for (uint32_t i = 0; i < args->num_joints; i++)
+    {
+        for (int c = 0; c < 3; c++)
+            acc += lerp(args->pos[0][i][c], args->pos[1][i][c], args->interp);
+    }
+
+    sink = acc;
+}
+
+static void kernel_q_nlerp(void *arg)
+{
+    kernel_args_t *args = arg;
+    int32_t acc = 0;
+
+    for (uint32_t i = 0; i < args->num_joints; i++)
+    {
+        int32_t q[4];
+        q_nlerp(args->orient[0][i], args->orient[1][i], args->interp, q);
+        acc += q[0] + q[1] + q[2] + q[3];
+    }
+
+    sink = acc;
+}
+
+static void kernel_dsa_interpolate_frames(void *arg)
+{
+    kernel_args_t *args = arg;
+    int32_t acc = 0;
+
+    for (uint32_t i = 0; i < args->num_joints; i++)
+    {
+        int32_t v[3], q[4];
+        dsa_interpolate_frames(args->pos[0][i], args->orient[0][i],
+                               args->pos[1][i], args->orient[1][i],
+                               args->interp, v, q);
+        acc += v[0] + v[1] + v[2] + q[0] + q[1] + q[2] + q[3];
+    }
+
+    sink = acc;
+}
+
+static void kernel_matrix_from_joint(void *arg)
+{
+    kernel_args_t *args = arg;
+    int32_t acc = 0;
+
+    for (uint32_t i = 0; i < args->num_joints; i++)
+    {
+        int32_t m[12];
+        matrix_from_joint(args->pos[0][i], args->orient[0][i], m);
+        acc += m[0] + m[4] + m[8] + m[11];
+    }
+
+    sink = acc;
+}
+
+static void kernel_matrix_mult_by_joint(void *arg)
+{
+    kernel_args_t *args = arg;
+
+    for (uint32_t i = 0; i < args->num_joints; i++)
+        matrix_mult_by_joint(args->pos[0][i], args->orient[0][i]);
+}
+
+typedef struct {
+    const char *name;
+    bench_fn fn;
+    bool uses_quality; // It's run with all interpolation quality modes
+} kernel_t;
+
+static const kernel_t kernels[] = {
+    { "lerp", kernel_lerp, false },
+    { "q_nlerp", kernel_q_nlerp, true },
+    { "dsa_interpolate_frames", kernel_dsa_interpolate_frames, true },
+    { "matrix_from_joint", kernel_matrix_from_joint, false },
+    { "matrix_mult_by_joint", kernel_matrix_mult_by_joint, false },
+};
+#define NUM_KERNELS (sizeof(kernels) / sizeof(kernels[0]))
+
+static const char *quality_names[] = {
+    [DSMA_INTERPOLATION_FAST] = "fast",
+    [DSMA_INTERPOLATION_NORMALIZED] = "normalized",
+    [DSMA_INTERPOLATION_NORMALIZED_EXACT] = "exact",
+};
+#define NUM_QUALITIES (sizeof(quality_names) / sizeof(quality_names[0]))
+
+static void bench_kernels(void)
+{
+    static kernel_args_t args;
+
+    for (size_t j = 0; j < NUM_KERNEL_JOINT_COUNTS; j++)
+    {
+        kernel_args_init(&args, kernel_joints[j]);
+
+        for (size_t k = 0; k < NUM_KERNELS; k++)
+        {
+            uint32_t num_qualities = kernels[k].uses_quality ? NUM_QUALITIES : 1;
+
+            for (uint32_t q = 0; q < num_qualities; q++)
+            {
+                DSMA_SetInterpolationQuality(q);
+
+                double ns = bench_run(kernels[k].fn, &args);
+                print_result(kernels[k].name, quality_names[q], args.num_joints,
+                             ns);
+            }
+        }
+    }
+
+    DSMA_SetInterpolationQuality(DSMA_INTERPOLATION_FAST);
+}
+
+// Full poses
+// ----------
+
+typedef struct {
+    const void *dsm_file;
+    const void *dsa_file;
+    uint32_t num_frames;
+    uint32_t frame;       // Frame of the next call
+    uint32_t frame_fraction; // Fractional part added to all frames
+    void *pose;
+    int ret;              // Value returned by the last call
+} pose_args_t;
+
+// Returns the next frame to use, with the fractional part of the benchmark.
+static uint32_t pose_args_next_frame(pose_args_t *args)
+{
+    uint32_t frame = args->frame;
+
+    args->frame++;
+    if (args->frame == args->num_frames)
+        args->frame = 0;
+
+    return (frame << 12) | args->frame_fraction;
+}
+
+static void pose_compute(void *arg)
+{
+    pose_args_t *args = arg;
+    args->ret = DSMA_ComputePose(args->pose, args->dsa_file,
+                                 pose_args_next_frame(args));
+}
+
+static void pose_compute_blend(void *arg)
+{
+    pose_args_t *args = arg;
+    uint32_t frame = pose_args_next_frame(args);
+
+    // Blend the animation with itself, half a loop ahead
+    uint32_t other = frame + (args->num_frames << 11);
+    if ((other >> 12) >= args->num_frames)
+        other -= args->num_frames << 12;
+
+    args->ret = DSMA_ComputePoseBlendAnimation(args->pose, args->dsa_file, frame,
+                                               args->dsa_file, other,
+                                               inttof32(1) / 2);
+}
+
+static void pose_draw(void *arg)
+{
+    pose_args_t *args = arg;
+    args->ret = DSMA_DrawModel(args->dsm_file, args->dsa_file,
+                               pose_args_next_frame(args));
+}
+
+typedef struct {
+    const char *mode;
+    bench_fn fn;
+    uint32_t frame_fraction;
+    uint32_t quality;
+} pose_bench_t;
+
+static const pose_bench_t pose_benchs[] = {
+    { "exact", pose_compute, 0, DSMA_INTERPOLATION_FAST },
+    { "interp", pose_compute, 0x800, DSMA_INTERPOLATION_FAST },
+    { "interp_normalized", pose_compute, 0x800, DSMA_INTERPOLATION_NORMALIZED },
+    { "interp_exact", pose_compute, 0x800, DSMA_INTERPOLATION_NORMALIZED_EXACT },
+    { "blend", pose_compute_blend, 0x800, DSMA_INTERPOLATION_FAST },
+    { "draw_exact", pose_draw, 0, DSMA_INTERPOLATION_FAST },
+    { "draw_interp", pose_draw, 0x800, DSMA_INTERPOLATION_FAST },
+};
+#define NUM_POSE_BENCHS (sizeof(pose_benchs) / sizeof(pose_benchs[0]))
+
+// Returns the name of a file without folders or extension.
+static void get_base_name(const char *path, char *name, size_t size)
+{
+    const char *start = strrchr(path, '/');
+    start = (start == NULL) ? path : start + 1;
+
+    snprintf(name, size, "%s", start);
+
+    char *dot = strrchr(name, '.');
+    if (dot != NULL)
+        *dot = '\0';
+}
+
+static int bench_pose(const char *dsm_path, const char *dsa_path)
+{
+    void *dsm_file = file_load(dsm_path);
+    void *dsa_file = file_load(dsa_path);
+    if ((dsm_file == NULL) || (dsa_file == NULL))
+    {
+        free(dsm_file);
+        free(dsa_file);
+        return 1;
+    }
+
+    uint32_t num_joints = DSMA_GetNumJoints(dsa_file);
+
+    pose_args_t args = {
+        .dsm_file = dsm_file,
+        .dsa_file = dsa_file,
+        .num_frames = DSMA_GetNumFrames(dsa_file),
+        .pose = malloc(DSMA_POSE_SIZE(num_joints)),
+    };
+
+    char name[256];
+    char benchmark[300];
+    get_base_name(dsa_path, name, sizeof(name));
+    snprintf(benchmark, sizeof(benchmark), "pose:%s", name);
+
+    int ret = 0;
+
+    for (size_t i = 0; i < NUM_POSE_BENCHS; i++)
+    {
+        const pose_bench_t *bench = &pose_benchs[i];
+
+        args.frame_fraction = bench->frame_fraction;
+        DSMA_SetInterpolationQuality(bench->quality);
+
+        // Make sure that the benchmark doesn't measure an error path. Modes
+        // that the animation doesn't support (like blending DSA files with
+        // matrices) are skipped.
+        args.frame = 0;
+        bench->fn(&args);
+        if (args.ret == DSMA_INVALID_VERSION)
+        {
+            fprintf(stderr, "%s: %s not supported, skipped\n", name, bench->mode);
+            continue;
+        }
+        if (args.ret != DSMA_SUCCESS)
+        {
+            fprintf(stderr, "%s: %s failed: %d\n", name, bench->mode, args.ret);
+            ret = 1;
+            break;
+        }
+
+        args.frame = 0;
+        double ns = bench_run(bench->fn, &args);
+        print_result(benchmark, bench->mode, num_joints, ns);
+    }
+
+    DSMA_SetInterpolationQuality(DSMA_INTERPOLATION_FAST);
+
+    free(args.pose);
+    free(dsm_file);
+    free(dsa_file);
+
+    return ret;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *paths[MAX_PAIRS * 2];
+    size_t num_paths = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if ((strcmp(argv[i], "--min-time") == 0) && (i + 1 < argc))
+        {
+            min_time_ns = (uint64_t)atol(argv[++i]) * 1000000;
+        }
+        else if ((argv[i][0] == '-') || (num_paths == MAX_PAIRS * 2))
+        {
+            usage(argv[0]);
+            return 1;
+        }
+        else
+        {
+            paths[num_paths++] = argv[i];
+        }
+    }
+
+    if ((num_paths % 2) != 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // Only the CPU cost of the library is measured
+    gxsim_set_mode(GXSIM_MODE_DISCARD);
+    gxsim_reset();
+
+    glMatrixMode(GL_MODELVIEW);
+    glLoadIdentity();
+
+    printf("benchmark,mode,joints,ns_per_joint,ns_per_pose\n");
+
+    bench_kernels();
+
+    for (size_t i = 0; i < num_paths; i += 2)
+    {
+        if (bench_pose(paths[i], paths[i + 1]) != 0)
+            return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,734 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2022 Antonio Niño Díaz <antonio_nd@outlook.com>
+
+// Host driver for DSMA. It draws DSM/DSA files with the simulated geometry
+// engine and dumps the resulting command stream, or measures how long it takes
+// to draw them.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <nds.h>
+
+#include "dsma.h"
+
+static void usage(const char *name)
+{
+    printf("Usage: %s [options] model.dsm anim.dsa\n"
+           "       %s [options] --baked model.dsm\n"
+           "       %s --stats model.dsm\n"
+           "\n"
+           "Options:\n"
+           "  --frame F             Draw frame F (it can have a fractional part).\n"
+           "                        It can be used multiple times. By default all\n"
+           "                        frames are drawn in steps of 0.5.\n"
+           "  --blend anim.dsa F B  Blend with the frame F of a second animation,\n"
+           "                        with a blending factor B (0.0 to 1.0).\n"
+           "  --mix anim.dsa F W    Mix the frame F of another animation with a\n"
+           "                        weight W (0.0 to 1.0). It can be used up to\n"
+           "                        %d times. The main animation gets the weight\n"
+           "                        left by the others.\n"
+           "  --mask anim.dsa F J0 J1 B\n"
+           "                        Blend with the frame F of another animation,\n"
+           "                        but only joints J0 to J1, with a blending\n"
+           "                        factor B (0.0 to 1.0).\n"
+           "  --pose                Calculate a pose and draw it instead of\n"
+           "                        drawing the model directly.\n"
+           "  --instances N B       Draw N instances of the model per frame, each\n"
+           "                        one with its frame advanced by 1/4 and moved\n"
+           "                        one unit along X. Frames are quantized by\n"
+           "                        clearing B bits.\n"
+           "  --command-buffer      Send the matrices of the joints with a command\n"
+           "                        buffer instead of writing them to registers.\n"
+           "  --interpolation Q     Interpolation quality: fast (default),\n"
+           "                        normalized or exact.\n"
+           "  --baked               Draw a baked model. It doesn't need a DSA file.\n"
+           "  --container FILE      Look up the model and the animations (the main\n"
+           "                        one and the one of --blend) by name in a\n"
+           "                        container file instead of loading them.\n"
+           "  --stream N            Stream the main animation from its file with\n"
+           "                        a window of N frames instead of loading it.\n"
+           "  --bounds FILE         Test the bounding box of the frame in FILE\n"
+           "                        before drawing it, and skip frames that\n"
+           "                        aren't visible.\n"
+           "  --stats               Print the statistics of the model returned by\n"
+           "                        DSMA_GetModelStats() and exit.\n"
+           "  --bench N             Draw all the frames N times and print the\n"
+           "                        time it takes instead of the command list.\n"
+           "  --counters            Print the counters of DSMA_GetStats() to the\n"
+           "                        error output at the end. The library must be\n"
+           "                        built with DSMA_STATS (make STATS=1).\n"
+           "  --output FILE         Write the command list to FILE instead of\n"
+           "                        the standard output.\n",
+           name, name, name, DSMA_MAX_BLEND_SOURCES - 1);
+}
+
+static void *file_load(const char *filename, size_t *size_)
+{
+    FILE *f = fopen(filename, "rb");
+    if (f == NULL)
+    {
+        fprintf(stderr, "%s couldn't be opened!\n", filename);
+        return NULL;
+    }
+
+    fseek(f, 0, SEEK_END);
+    size_t size = ftell(f);
+    rewind(f);
+
+    // Allocate one extra word so that empty files are handled gracefully
+    void *buffer = calloc(1, size + sizeof(uint32_t));
+    if (buffer == NULL)
+    {
+        fprintf(stderr, "Not enough memory to load %s!\n", filename);
+        fclose(f);
+        return NULL;
+    }
+
+    if (fread(buffer, 1, size, f) != size)
+    {
+        fprintf(stderr, "Error while reading %s!\n", filename);
+        fclose(f);
+        free(buffer);
+        return NULL;
+    }
+
+    fclose(f);
+
+    if (size_)
+        *size_ = size;
+
+    return buffer;
+}
+
+// Container used by load(), or NULL to load files from disk.
+static const void *container = NULL;
+
+static const void *load(const char *name)
+{
+    if (container == NULL)
+        return file_load(name, NULL);
+
+    const void *file = DSMA_ContainerGetFile(container, name);
+    if (file == NULL)
+        fprintf(stderr, "%s not found in the container!\n", name);
+
+    return file;
+}
+
+static int stream_read(void *arg, uint32_t offset, void *buffer,
+                       uint32_t size)
+{
+    FILE *f = arg;
+
+    if (fseek(f, offset, SEEK_SET) != 0)
+        return -1;
+
+    if (fread(buffer, 1, size, f) != size)
+        return -1;
+
+    return 0;
+}
+
+static uint64_t time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Clock used by the library to measure the time it spends waiting for the
+// matrix stack.
+static uint32_t stats_clock(void)
+{
+    return (uint32_t)time_ns();
+}
+
+static void print_counters(void)
+{
+#ifdef DSMA_STATS
+    DSMA_Stats stats;
+    DSMA_GetStats(&stats);
+
+    fprintf(stderr, "Joints evaluated:    %u\n", stats.joints_evaluated);
+    fprintf(stderr, "Frames exact:        %u\n", stats.frames_exact);
+    fprintf(stderr, "Frames interpolated: %u\n", stats.frames_interpolated);
+    fprintf(stderr, "Blends:              %u\n", stats.blends);
+    fprintf(stderr, "GX words (CPU):      %u\n", stats.gx_words_cpu);
+    fprintf(stderr, "GX words (DMA):      %u\n", stats.gx_words_dma);
+    fprintf(stderr, "Stack wait polls:    %u\n", stats.stack_wait_polls);
+    fprintf(stderr, "Stack wait:          %u ns\n", stats.stack_wait_ticks);
+#else
+    fprintf(stderr, "The library has been built without DSMA_STATS\n");
+#endif
+}
+
+// Animations added with --mix. The first entry is reserved for the main
+// animation, which gets the weight that the others leave.
+static DSMA_BlendSource mix_sources[DSMA_MAX_BLEND_SOURCES];
+static uint32_t num_mix_sources = 1;
+
+static int draw_mix(const void *dsm_file, const void *dsa_file, uint32_t frame,
+                    void *pose)
+{
+    uint32_t weight = inttof32(1);
+    for (uint32_t i = 1; i < num_mix_sources; i++)
+        weight -= mix_sources[i].weight;
+
+    mix_sources[0].dsa_file = dsa_file;
+    mix_sources[0].frame_interp = frame;
+    mix_sources[0].weight = weight;
+
+    if (pose != NULL)
+    {
+        int ret = DSMA_ComputePoseBlendMultiple(pose, mix_sources,
+                                                num_mix_sources);
+        if (ret != DSMA_SUCCESS)
+            return ret;
+
+        return DSMA_DrawModelPose(dsm_file, pose);
+    }
+
+    return DSMA_DrawModelBlendMultiple(dsm_file, mix_sources, num_mix_sources);
+}
+
+// Animation added with --mask. It is only applied to a range of joints.
+static const void *mask_dsa_file = NULL;
+static uint32_t mask_frame = 0;
+static uint32_t mask_blend = 0;
+static uint16_t mask[256];
+
+static int draw_mask(const void *dsm_file, const void *dsa_file, uint32_t frame,
+                     void *pose)
+{
+    if (pose != NULL)
+    {
+        int ret = DSMA_ComputePoseBlendAnimationMask(pose, dsa_file, frame,
+                                                     mask_dsa_file, mask_frame,
+                                                     mask, mask_blend);
+        if (ret != DSMA_SUCCESS)
+            return ret;
+
+        return DSMA_DrawModelPose(dsm_file, pose);
+    }
+
+    return DSMA_DrawModelBlendAnimationMask(dsm_file, dsa_file, frame,
+                                            mask_dsa_file, mask_frame,
+                                            mask, mask_blend);
+}
+
+// Set by --baked. The model is drawn with DSMA_DrawModelBaked().
+static bool use_baked = false;
+
+// Set by --bounds. Frames that aren't visible aren't drawn.
+static const void *bounds_file = NULL;
+
+// Set by --stream. The main animation is read from its file as needed.
+static bool use_stream = false;
+static DSMA_Stream stream;
+
+static int draw(const void *dsm_file, const void *dsa_file, uint32_t frame,
+                const void *dsa_blend_file, uint32_t frame_blend,
+                uint32_t blend, void *pose)
+{
+    if (use_baked)
+        return DSMA_DrawModelBaked(dsm_file, frame);
+
+    if (bounds_file != NULL)
+    {
+        int ret = DSMA_TestBounds(bounds_file, frame);
+        if (ret != 1)
+            return ret;
+    }
+
+    if (use_stream)
+    {
+        int ret = DSMA_StreamSetFrame(&stream, frame, &frame);
+        if (ret != DSMA_SUCCESS)
+            return ret;
+
+        dsa_file = DSMA_StreamGetDSA(&stream);
+    }
+
+    if (num_mix_sources > 1)
+        return draw_mix(dsm_file, dsa_file, frame, pose);
+
+    if (mask_dsa_file != NULL)
+        return draw_mask(dsm_file, dsa_file, frame, pose);
+
+    if (pose != NULL)
+    {
+        int ret;
+
+        if (dsa_blend_file != NULL)
+        {
+            ret = DSMA_ComputePoseBlendAnimation(pose, dsa_file, frame,
+                                                 dsa_blend_file, frame_blend,
+                                                 blend);
+        }
+        else
+        {
+            ret = DSMA_ComputePose(pose, dsa_file, frame);
+        }
+
+        if (ret != DSMA_SUCCESS)
+            return ret;
+
+        return DSMA_DrawModelPose(dsm_file, pose);
+    }
+
+    if (dsa_blend_file != NULL)
+    {
+        return DSMA_DrawModelBlendAnimation(dsm_file, dsa_file, frame,
+                                            dsa_blend_file, frame_blend, blend);
+    }
+
+    return DSMA_DrawModel(dsm_file, dsa_file, frame);
+}
+
+#define MAX_INSTANCES 256
+
+static int draw_instances(const void *dsm_file, const void *dsa_file,
+                          uint32_t frame, uint32_t num_instances,
+                          uint32_t quantization_bits)
+{
+    static DSMA_Instance instances[MAX_INSTANCES];
+
+    uint32_t total = inttof32(DSMA_GetNumFrames(dsa_file));
+
+    for (uint32_t i = 0; i < num_instances; i++)
+    {
+        DSMA_Instance *inst = &instances[i];
+
+        memset(inst, 0, sizeof(DSMA_Instance));
+
+        inst->frame_interp = (frame + i * (inttof32(1) / 4)) % total;
+        inst->matrix[0] = inttof32(1);
+        inst->matrix[4] = inttof32(1);
+        inst->matrix[8] = inttof32(1);
+        inst->matrix[9] = inttof32(i);
+    }
+
+    return DSMA_DrawModelInstances(dsm_file, dsa_file, instances, num_instances,
+                                   quantization_bits);
+}
+
+#define MAX_FRAMES 1024
+
+int main(int argc, char *argv[])
+{
+    const char *dsm_path = NULL;
+    const char *dsa_path = NULL;
+    const char *dsa_blend_path = NULL;
+    const char *output_path = NULL;
+    const char *container_path = NULL;
+    uint32_t frame_blend = 0;
+    uint32_t blend = 0;
+    long bench_iterations = 0;
+    bool use_pose = false;
+    uint32_t num_instances = 0;
+    bool use_command_buffer = false;
+    uint32_t quantization_bits = 0;
+    uint32_t stream_window = 0;
+    bool print_stats = false;
+    bool print_stats_counters = false;
+
+    static uint32_t frames[MAX_FRAMES];
+    size_t num_frames = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if ((strcmp(argv[i], "--frame") == 0) && (i + 1 < argc))
+        {
+            if (num_frames == MAX_FRAMES)
+            {
+                fprintf(stderr, "Too many frames\n");
+                return 1;
+            }
+            frames[num_frames++] = floattof32(atof(argv[++i]));
+        }
+        else if ((strcmp(argv[i], "--blend") == 0) && (i + 3 < argc))
+        {
+            dsa_blend_path = argv[++i];
+            frame_blend = floattof32(atof(argv[++i]));
+            blend = floattof32(atof(argv[++i]));
+        }
+        else if ((strcmp(argv[i], "--mix") == 0) && (i + 3 < argc))
+        {
+            if (num_mix_sources == DSMA_MAX_BLEND_SOURCES)
+            {
+                fprintf(stderr, "Too many animations to mix\n");
+                return 1;
+            }
+
+            DSMA_BlendSource *source = &mix_sources[num_mix_sources++];
+            source->dsa_file = file_load(argv[++i], NULL);
+            if (source->dsa_file == NULL)
+                return 1;
+            source->frame_interp = floattof32(atof(argv[++i]));
+            source->weight = floattof32(atof(argv[++i]));
+        }
+        else if ((strcmp(argv[i], "--mask") == 0) && (i + 5 < argc))
+        {
+            mask_dsa_file = file_load(argv[++i], NULL);
+            if (mask_dsa_file == NULL)
+                return 1;
+            mask_frame = floattof32(atof(argv[++i]));
+
+            size_t first = atoi(argv[++i]);
+            size_t last = atoi(argv[++i]);
+            for (size_t j = first; (j <= last) && (j < 256); j++)
+                mask[j] = inttof32(1);
+
+            mask_blend = floattof32(atof(argv[++i]));
+        }
+        else if (strcmp(argv[i], "--pose") == 0)
+        {
+            use_pose = true;
+        }
+        else if ((strcmp(argv[i], "--instances") == 0) && (i + 2 < argc))
+        {
+            num_instances = atoi(argv[++i]);
+            quantization_bits = atoi(argv[++i]);
+            if ((num_instances == 0) || (num_instances > MAX_INSTANCES))
+            {
+                fprintf(stderr, "Invalid number of instances\n");
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--command-buffer") == 0)
+        {
+            use_command_buffer = true;
+        }
+        else if ((strcmp(argv[i], "--interpolation") == 0) && (i + 1 < argc))
+        {
+            const char *quality = argv[++i];
+            if (strcmp(quality, "fast") == 0)
+            {
+                DSMA_SetInterpolationQuality(DSMA_INTERPOLATION_FAST);
+            }
+            else if (strcmp(quality, "normalized") == 0)
+            {
+                DSMA_SetInterpolationQuality(DSMA_INTERPOLATION_NORMALIZED);
+            }
+            else if (strcmp(quality, "exact") == 0)
+            {
+                DSMA_SetInterpolationQuality(DSMA_INTERPOLATION_NORMALIZED_EXACT);
+            }
+            else
+            {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--baked") == 0)
+        {
+            use_baked = true;
+        }
+        else if ((strcmp(argv[i], "--bounds") == 0) && (i + 1 < argc))
+        {
+            bounds_file = file_load(argv[++i], NULL);
+            if (bounds_file == NULL)
+                return 1;
+        }
+        else if (strcmp(argv[i], "--stats") == 0)
+        {
+            print_stats = true;
+        }
+        else if (strcmp(argv[i], "--counters") == 0)
+        {
+            print_stats_counters = true;
+        }
+        else if ((strcmp(argv[i], "--bench") == 0) && (i + 1 < argc))
+        {
+            bench_iterations = atol(argv[++i]);
+        }
+        else if ((strcmp(argv[i], "--stream") == 0) && (i + 1 < argc))
+        {
+            stream_window = atoi(argv[++i]);
+            use_stream = true;
+        }
+        else if ((strcmp(argv[i], "--container") == 0) && (i + 1 < argc))
+        {
+            container_path = argv[++i];
+        }
+        else if ((strcmp(argv[i], "--output") == 0) && (i + 1 < argc))
+        {
+            output_path = argv[++i];
+        }
+        else if (argv[i][0] == '-')
+        {
+            usage(argv[0]);
+            return 1;
+        }
+        else if (dsm_path == NULL)
+        {
+            dsm_path = argv[i];
+        }
+        else if (dsa_path == NULL)
+        {
+            dsa_path = argv[i];
+        }
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (print_stats && (dsm_path != NULL))
+    {
+        void *dsm_file = file_load(dsm_path, NULL);
+        if (dsm_file == NULL)
+            return 1;
+
+        DSMA_ModelStats stats;
+        int ret = DSMA_GetModelStats(dsm_file, &stats);
+        free(dsm_file);
+
+        if (ret != DSMA_SUCCESS)
+        {
+            fprintf(stderr, "Invalid model: %d\n", ret);
+            return 1;
+        }
+
+        printf("Polygons: %u\n", stats.num_polygons);
+        printf("Vertices: %u\n", stats.num_vertices);
+        printf("Words:    %u\n", stats.num_words);
+        printf("Cycles:   %u\n", stats.num_cycles);
+        return 0;
+    }
+
+    // Baked models don't need a DSA file. They store the number of frames in
+    // the same place as DSA files, so they can be used instead.
+    if (use_baked && (dsa_path == NULL))
+        dsa_path = dsm_path;
+
+    if ((dsm_path == NULL) || (dsa_path == NULL))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (use_stream && (use_baked || (container_path != NULL) ||
+                       (num_instances > 0) || (num_mix_sources > 1) ||
+                       (mask_dsa_file != NULL)))
+    {
+        fprintf(stderr, "--stream can only be used with --blend and --pose\n");
+        return 1;
+    }
+
+    if (container_path != NULL)
+    {
+        container = file_load(container_path, NULL);
+        if (container == NULL)
+            return 1;
+    }
+
+    const void *dsm_file = load(dsm_path);
+    const void *dsa_file = NULL;
+    const void *dsa_blend_file = NULL;
+
+    if (use_stream)
+    {
+        FILE *f = fopen(dsa_path, "rb");
+        if (f == NULL)
+        {
+            fprintf(stderr, "%s couldn't be opened!\n", dsa_path);
+            return 1;
+        }
+
+        // Read the header to get the number of joints of the animation
+        uint32_t header[3];
+        if (stream_read(f, 0, header, sizeof(header)) != 0)
+        {
+            fprintf(stderr, "Error while reading %s!\n", dsa_path);
+            return 1;
+        }
+
+        size_t size = DSMA_STREAM_BUFFER_SIZE(header[2], stream_window);
+        void *buffer = malloc(size);
+        if (buffer == NULL)
+            return 1;
+
+        int ret = DSMA_StreamInit(&stream, buffer, size, stream_read, f);
+        if (ret != DSMA_SUCCESS)
+        {
+            fprintf(stderr, "%s can't be streamed: %d\n", dsa_path, ret);
+            return 1;
+        }
+
+        dsa_file = DSMA_StreamGetDSA(&stream);
+    }
+    else
+    {
+        dsa_file = load(dsa_path);
+    }
+
+    if ((dsm_file == NULL) || (dsa_file == NULL))
+        return 1;
+
+    if (dsa_blend_path != NULL)
+    {
+        dsa_blend_file = load(dsa_blend_path);
+        if (dsa_blend_file == NULL)
+            return 1;
+    }
+
+    if (num_frames == 0)
+    {
+        uint32_t total = DSMA_GetNumFrames(dsa_file);
+        if (use_stream)
+            total = DSMA_StreamGetNumFrames(&stream);
+        for (uint32_t f = 0; f < (uint32_t)inttof32(total); f += inttof32(1) / 2)
+        {
+            if (num_frames == MAX_FRAMES)
+                break;
+            frames[num_frames++] = f;
+        }
+    }
+
+    void *pose = NULL;
+    if (use_pose)
+    {
+        pose = malloc(DSMA_POSE_SIZE(DSMA_GetNumJoints(dsa_file)));
+        if (pose == NULL)
+            return 1;
+    }
+
+    void *command_buffer = NULL;
+    if (use_command_buffer)
+    {
+        size_t size = DSMA_COMMAND_BUFFER_SIZE(DSMA_GetNumJoints(dsa_file));
+        command_buffer = malloc(size);
+        if (command_buffer == NULL)
+            return 1;
+
+        DSMA_SetCommandBuffer(command_buffer, size);
+    }
+
+    gxsim_reset();
+
+    DSMA_ResetStats();
+    DSMA_SetStatsClock(stats_clock);
+
+    glMatrixMode(GL_MODELVIEW);
+    glLoadIdentity();
+
+    if (bench_iterations > 0)
+    {
+        gxsim_set_mode(GXSIM_MODE_DISCARD);
+
+        uint64_t start = time_ns();
+
+        for (long it = 0; it < bench_iterations; it++)
+        {
+            for (size_t i = 0; i < num_frames; i++)
+            {
+                if (num_instances > 0)
+                {
+                    draw_instances(dsm_file, dsa_file, frames[i], num_instances,
+                                   quantization_bits);
+                }
+                else
+                {
+                    draw(dsm_file, dsa_file, frames[i], dsa_blend_file,
+                         frame_blend, blend, pose);
+                }
+            }
+        }
+
+        uint64_t end = time_ns();
+
+        uint64_t draws = (uint64_t)bench_iterations * num_frames;
+        printf("Draws: %llu\n", (unsigned long long)draws);
+        printf("Total: %llu ns\n", (unsigned long long)(end - start));
+        printf("Draw:  %.1f ns\n", (double)(end - start) / draws);
+
+        if (print_stats_counters)
+            print_counters();
+        return 0;
+    }
+
+    FILE *out = stdout;
+    if (output_path != NULL)
+    {
+        out = fopen(output_path, "w");
+        if (out == NULL)
+        {
+            fprintf(stderr, "%s couldn't be opened!\n", output_path);
+            return 1;
+        }
+    }
+
+    gxsim_set_mode(GXSIM_MODE_RECORD);
+
+    int failed = 0;
+
+    for (size_t i = 0; i < num_frames; i++)
+    {
+        gxsim_log_clear();
+
+        uint32_t polys_start = gxsim_polygon_count();
+        uint32_t vertices_start = gxsim_vertex_count();
+
+        int ret;
+        if (num_instances > 0)
+        {
+            ret = draw_instances(dsm_file, dsa_file, frames[i], num_instances,
+                                 quantization_bits);
+        }
+        else
+        {
+            ret = draw(dsm_file, dsa_file, frames[i], dsa_blend_file,
+                       frame_blend, blend, pose);
+        }
+
+        fprintf(out, "# Frame %08X: ret %d, polys %u, vertices %u, commands %zu\n",
+                frames[i], ret, gxsim_polygon_count() - polys_start,
+                gxsim_vertex_count() - vertices_start, gxsim_log_size());
+        gxsim_log_dump(out);
+
+        if (ret != DSMA_SUCCESS)
+            failed = 1;
+
+        // The library must leave the matrix stack as it found it
+        if (((GFX_STATUS >> 8) & 0x1F) != 0)
+        {
+            fprintf(stderr, "Matrix stack not balanced after frame %08X\n",
+                    frames[i]);
+            failed = 1;
+        }
+    }
+
+    if (out != stdout)
+        fclose(out);
+
+    if (print_stats_counters)
+        print_counters();
+
+    if (container != NULL)
+    {
+        // The files are inside the container
+        free((void *)container);
+    }
+    else
+    {
+        free((void *)dsm_file);
+        free((void *)dsa_file);
+        free((void *)dsa_blend_file);
+    }
+    if (use_stream)
+        fclose(stream.arg);
+    for (uint32_t i = 1; i < num_mix_sources; i++)
+        free((void *)mix_sources[i].dsa_file);
+    free((void *)mask_dsa_file);
+    free((void *)bounds_file);
+    free(pose);
+    free(command_buffer);
+
+    return failed;
+}
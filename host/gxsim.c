@@ -0,0 +1,709 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2022 Antonio Niño Díaz <antonio_nd@outlook.com>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "gxsim.h"
+
+// Matrices are 4x4 fixed point 20.12 values stored in row-major order. Like in
+// the real hardware, vectors are multiplied as rows: v' = v * M, so the
+// translation is stored in the last row.
+typedef struct {
+    int32_t m[16];
+} gxsim_matrix_t;
+
+typedef struct {
+    const char *name;
+    uint8_t num_params;
+} gxsim_command_info_t;
+
+static const gxsim_command_info_t command_info[256] = {
+    [GXSIM_NOP]          = { "NOP", 0 },
+    [GXSIM_MTX_MODE]     = { "MTX_MODE", 1 },
+    [GXSIM_MTX_PUSH]     = { "MTX_PUSH", 0 },
+    [GXSIM_MTX_POP]      = { "MTX_POP", 1 },
+    [GXSIM_MTX_STORE]    = { "MTX_STORE", 1 },
+    [GXSIM_MTX_RESTORE]  = { "MTX_RESTORE", 1 },
+    [GXSIM_MTX_IDENTITY] = { "MTX_IDENTITY", 0 },
+    [GXSIM_MTX_LOAD_4x4] = { "MTX_LOAD_4x4", 16 },
+    [GXSIM_MTX_LOAD_4x3] = { "MTX_LOAD_4x3", 12 },
+    [GXSIM_MTX_MULT_4x4] = { "MTX_MULT_4x4", 16 },
+    [GXSIM_MTX_MULT_4x3] = { "MTX_MULT_4x3", 12 },
+    [GXSIM_MTX_MULT_3x3] = { "MTX_MULT_3x3", 9 },
+    [GXSIM_MTX_SCALE]    = { "MTX_SCALE", 3 },
+    [GXSIM_MTX_TRANS]    = { "MTX_TRANS", 3 },
+    [GXSIM_COLOR]        = { "COLOR", 1 },
+    [GXSIM_NORMAL]       = { "NORMAL", 1 },
+    [GXSIM_TEXCOORD]     = { "TEXCOORD", 1 },
+    [GXSIM_VTX_16]       = { "VTX_16", 2 },
+    [GXSIM_VTX_10]       = { "VTX_10", 1 },
+    [GXSIM_VTX_XY]       = { "VTX_XY", 1 },
+    [GXSIM_VTX_XZ]       = { "VTX_XZ", 1 },
+    [GXSIM_VTX_YZ]       = { "VTX_YZ", 1 },
+    [GXSIM_VTX_DIFF]     = { "VTX_DIFF", 1 },
+    [GXSIM_POLYGON_ATTR] = { "POLYGON_ATTR", 1 },
+    [GXSIM_TEXIMAGE]     = { "TEXIMAGE_PARAM", 1 },
+    [GXSIM_PLTT_BASE]    = { "PLTT_BASE", 1 },
+    [GXSIM_DIF_AMB]      = { "DIF_AMB", 1 },
+    [GXSIM_SPE_EMI]      = { "SPE_EMI", 1 },
+    [GXSIM_LIGHT_VECTOR] = { "LIGHT_VECTOR", 1 },
+    [GXSIM_LIGHT_COLOR]  = { "LIGHT_COLOR", 1 },
+    [GXSIM_SHININESS]    = { "SHININESS", 32 },
+    [GXSIM_BEGIN_VTXS]   = { "BEGIN_VTXS", 1 },
+    [GXSIM_END_VTXS]     = { "END_VTXS", 0 },
+    [GXSIM_SWAP_BUFFERS] = { "SWAP_BUFFERS", 1 },
+    [GXSIM_VIEWPORT]     = { "VIEWPORT", 1 },
+    [GXSIM_BOX_TEST]     = { "BOX_TEST", 3 },
+    [GXSIM_POS_TEST]     = { "POS_TEST", 2 },
+    [GXSIM_VEC_TEST]     = { "VEC_TEST", 1 },
+};
+
+static struct {
+    gxsim_mode_t mode;
+
+    // Register write that hasn't been processed yet
+    int pending;
+    uint32_t pending_port;
+    uint32_t pending_value;
+
+    // Command currently receiving parameters
+    uint32_t cmd;
+    uint32_t cmd_params_left;
+    gxsim_entry_t entry;
+
+    // Packed commands received through the FIFO port
+    uint32_t fifo_cmds;
+    uint32_t fifo_cmds_left;
+
+    // Matrices
+    uint32_t matrix_mode;
+    gxsim_matrix_t projection;
+    gxsim_matrix_t projection_stack;
+    gxsim_matrix_t position;
+    gxsim_matrix_t position_stack[GXSIM_STACK_SIZE + 1];
+    gxsim_matrix_t texture;
+    uint32_t stack_pointer;
+    int stack_error;
+
+    // Polygon assembly
+    uint32_t poly_type;
+    uint32_t poly_vertices;
+    int32_t vtx[3];
+    uint32_t polygon_count;
+    uint32_t vertex_count;
+
+    // Result of the last BOX_TEST
+    int box_test_result;
+
+    // Command log
+    gxsim_entry_t *log;
+    size_t log_size;
+    size_t log_capacity;
+} gx = {
+    .mode = GXSIM_MODE_RECORD,
+};
+
+// Matrix helpers
+// ==============
+
+static void matrix_identity(gxsim_matrix_t *m)
+{
+    memset(m, 0, sizeof(gxsim_matrix_t));
+    m->m[0] = m->m[5] = m->m[10] = m->m[15] = 1 << 12;
+}
+
+// dest = a * b
+static void matrix_mult(gxsim_matrix_t *dest, const gxsim_matrix_t *a,
+                        const gxsim_matrix_t *b)
+{
+    gxsim_matrix_t r;
+
+    for (int i = 0; i < 4; i++)
+    {
+        for (int j = 0; j < 4; j++)
+        {
+            int64_t sum = 0;
+            for (int k = 0; k < 4; k++)
+                sum += (int64_t)a->m[i * 4 + k] * b->m[k * 4 + j];
+            r.m[i * 4 + j] = (int32_t)(sum >> 12);
+        }
+    }
+
+    *dest = r;
+}
+
+static gxsim_matrix_t *current_matrix(void)
+{
+    if (gx.matrix_mode == 0)
+        return &gx.projection;
+    if (gx.matrix_mode == 3)
+        return &gx.texture;
+    return &gx.position;
+}
+
+// Builds a 4x4 matrix out of the parameters of a MTX_*_4x3 or MTX_*_3x3
+// command.
+static void matrix_from_params(gxsim_matrix_t *m, const int32_t *p,
+                               int rows, int cols)
+{
+    matrix_identity(m);
+
+    for (int i = 0; i < rows; i++)
+        for (int j = 0; j < cols; j++)
+            m->m[i * 4 + j] = p[i * cols + j];
+}
+
+static void matrix_load(const gxsim_matrix_t *m)
+{
+    *current_matrix() = *m;
+}
+
+// The new matrix is multiplied from the left: current = m * current
+static void matrix_apply(const gxsim_matrix_t *m)
+{
+    gxsim_matrix_t *curr = current_matrix();
+    matrix_mult(curr, m, curr);
+}
+
+static int32_t sign_extend(uint32_t value, int bits)
+{
+    uint32_t shift = 32 - bits;
+    return (int32_t)(value << shift) >> shift;
+}
+
+// Command log
+// ===========
+
+static void log_append(const gxsim_entry_t *entry)
+{
+    if (gx.log_size == gx.log_capacity)
+    {
+        size_t capacity = gx.log_capacity ? gx.log_capacity * 2 : 1024;
+        gxsim_entry_t *log = realloc(gx.log, capacity * sizeof(gxsim_entry_t));
+        if (log == NULL)
+        {
+            fprintf(stderr, "gxsim: Not enough memory for command log\n");
+            exit(1);
+        }
+        gx.log = log;
+        gx.log_capacity = capacity;
+    }
+
+    gx.log[gx.log_size++] = *entry;
+}
+
+size_t gxsim_log_size(void)
+{
+    gxsim_flush();
+    return gx.log_size;
+}
+
+const gxsim_entry_t *gxsim_log_entry(size_t index)
+{
+    if (index >= gx.log_size)
+        return NULL;
+
+    return &gx.log[index];
+}
+
+void gxsim_log_clear(void)
+{
+    gxsim_flush();
+    gx.log_size = 0;
+}
+
+const char *gxsim_command_name(uint32_t cmd)
+{
+    if (cmd > 0xFF)
+        return NULL;
+    return command_info[cmd].name;
+}
+
+static int is_vertex_command(uint32_t cmd)
+{
+    return (cmd >= GXSIM_VTX_16) && (cmd <= GXSIM_VTX_DIFF);
+}
+
+void gxsim_log_dump(FILE *f)
+{
+    gxsim_flush();
+
+    for (size_t i = 0; i < gx.log_size; i++)
+    {
+        const gxsim_entry_t *e = &gx.log[i];
+
+        fprintf(f, "%s", command_info[e->cmd].name);
+        for (int p = 0; p < e->num_params; p++)
+            fprintf(f, " %08X", (uint32_t)e->params[p]);
+
+        if (is_vertex_command(e->cmd))
+        {
+            fprintf(f, " : (%d, %d, %d) -> (%d, %d, %d)",
+                    e->vtx[0], e->vtx[1], e->vtx[2],
+                    e->vtx_world[0], e->vtx_world[1], e->vtx_world[2]);
+        }
+
+        fprintf(f, "\n");
+    }
+}
+
+// Command execution
+// =================
+
+static void polygon_add_vertex(void)
+{
+    gx.vertex_count++;
+    gx.poly_vertices++;
+
+    switch (gx.poly_type)
+    {
+        case 0: // Triangles
+            if ((gx.poly_vertices % 3) == 0)
+                gx.polygon_count++;
+            break;
+        case 1: // Quads
+            if ((gx.poly_vertices % 4) == 0)
+                gx.polygon_count++;
+            break;
+        case 2: // Triangle strip
+            if (gx.poly_vertices >= 3)
+                gx.polygon_count++;
+            break;
+        case 3: // Quad strip
+            if ((gx.poly_vertices >= 4) && ((gx.poly_vertices % 2) == 0))
+                gx.polygon_count++;
+            break;
+    }
+}
+
+static void vertex_transform(const int32_t *v, int32_t *out)
+{
+    const gxsim_matrix_t *m = &gx.position;
+
+    for (int j = 0; j < 3; j++)
+    {
+        int64_t sum = (int64_t)m->m[12 + j] << 12;
+        for (int k = 0; k < 3; k++)
+            sum += (int64_t)v[k] * m->m[k * 4 + j];
+        out[j] = (int32_t)(sum >> 12);
+    }
+}
+
+// Returns 1 if any part of the box is inside the view volume. The corners of the
+// box are transformed by the clip matrix, and the box is outside if all of them
+// are outside of the same plane of the view volume. This is conservative: some
+// boxes close to the corners of the view volume are reported as visible.
+static int box_test(const int32_t *p)
+{
+    int32_t start[3] = {
+        sign_extend(p[0] & 0xFFFF, 16), sign_extend(p[0] >> 16, 16),
+        sign_extend(p[1] & 0xFFFF, 16)
+    };
+    int32_t size[3] = {
+        sign_extend(p[1] >> 16, 16), sign_extend(p[2] & 0xFFFF, 16),
+        sign_extend(p[2] >> 16, 16)
+    };
+
+    gxsim_matrix_t clip;
+    matrix_mult(&clip, &gx.position, &gx.projection);
+
+    // Bits of the planes that each corner is outside of
+    uint32_t outside_all = 0x3F;
+
+    for (int i = 0; i < 8; i++)
+    {
+        int32_t v[3];
+        for (int k = 0; k < 3; k++)
+            v[k] = start[k] + ((i & (1 << k)) ? size[k] : 0);
+
+        int64_t c[4];
+        for (int j = 0; j < 4; j++)
+        {
+            c[j] = (int64_t)clip.m[12 + j] << 12;
+            for (int k = 0; k < 3; k++)
+                c[j] += (int64_t)v[k] * clip.m[k * 4 + j];
+        }
+
+        uint32_t outside = 0;
+        for (int k = 0; k < 3; k++)
+        {
+            if (c[k] < -c[3])
+                outside |= 1 << (k * 2);
+            if (c[k] > c[3])
+                outside |= 1 << (k * 2 + 1);
+        }
+
+        outside_all &= outside;
+    }
+
+    return outside_all == 0;
+}
+
+static void command_execute(gxsim_entry_t *e)
+{
+    const int32_t *p = e->params;
+    gxsim_matrix_t m;
+
+    switch (e->cmd)
+    {
+        case GXSIM_MTX_MODE:
+            gx.matrix_mode = p[0] & 3;
+            break;
+
+        case GXSIM_MTX_PUSH:
+            if (gx.matrix_mode == 0)
+            {
+                gx.projection_stack = gx.projection;
+            }
+            else if ((gx.matrix_mode == 1) || (gx.matrix_mode == 2))
+            {
+                if (gx.stack_pointer >= GXSIM_STACK_SIZE)
+                    gx.stack_error = 1;
+                gx.position_stack[gx.stack_pointer & 31] = gx.position;
+                gx.stack_pointer = (gx.stack_pointer + 1) & 63;
+            }
+            break;
+
+        case GXSIM_MTX_POP:
+            if (gx.matrix_mode == 0)
+            {
+                gx.projection = gx.projection_stack;
+            }
+            else if ((gx.matrix_mode == 1) || (gx.matrix_mode == 2))
+            {
+                gx.stack_pointer = (gx.stack_pointer - sign_extend(p[0], 6)) & 63;
+                if (gx.stack_pointer >= GXSIM_STACK_SIZE)
+                    gx.stack_error = 1;
+                gx.position = gx.position_stack[gx.stack_pointer & 31];
+            }
+            break;
+
+        case GXSIM_MTX_STORE:
+            if (gx.matrix_mode == 0)
+            {
+                gx.projection_stack = gx.projection;
+            }
+            else if ((gx.matrix_mode == 1) || (gx.matrix_mode == 2))
+            {
+                uint32_t index = p[0] & 31;
+                if (index == 31)
+                    gx.stack_error = 1;
+                gx.position_stack[index] = gx.position;
+            }
+            break;
+
+        case GXSIM_MTX_RESTORE:
+            if (gx.matrix_mode == 0)
+            {
+                gx.projection = gx.projection_stack;
+            }
+            else if ((gx.matrix_mode == 1) || (gx.matrix_mode == 2))
+            {
+                uint32_t index = p[0] & 31;
+                if (index == 31)
+                    gx.stack_error = 1;
+                gx.position = gx.position_stack[index];
+            }
+            break;
+
+        case GXSIM_MTX_IDENTITY:
+            matrix_identity(&m);
+            matrix_load(&m);
+            break;
+
+        case GXSIM_MTX_LOAD_4x4:
+            matrix_from_params(&m, p, 4, 4);
+            matrix_load(&m);
+            break;
+
+        case GXSIM_MTX_LOAD_4x3:
+            matrix_from_params(&m, p, 4, 3);
+            matrix_load(&m);
+            break;
+
+        case GXSIM_MTX_MULT_4x4:
+            matrix_from_params(&m, p, 4, 4);
+            matrix_apply(&m);
+            break;
+
+        case GXSIM_MTX_MULT_4x3:
+            matrix_from_params(&m, p, 4, 3);
+            matrix_apply(&m);
+            break;
+
+        case GXSIM_MTX_MULT_3x3:
+            matrix_from_params(&m, p, 3, 3);
+            matrix_apply(&m);
+            break;
+
+        case GXSIM_MTX_SCALE:
+            matrix_identity(&m);
+            m.m[0] = p[0];
+            m.m[5] = p[1];
+            m.m[10] = p[2];
+            matrix_apply(&m);
+            break;
+
+        case GXSIM_MTX_TRANS:
+            matrix_identity(&m);
+            m.m[12] = p[0];
+            m.m[13] = p[1];
+            m.m[14] = p[2];
+            matrix_apply(&m);
+            break;
+
+        case GXSIM_VTX_16:
+            gx.vtx[0] = sign_extend(p[0] & 0xFFFF, 16);
+            gx.vtx[1] = sign_extend((uint32_t)p[0] >> 16, 16);
+            gx.vtx[2] = sign_extend(p[1] & 0xFFFF, 16);
+            break;
+
+        case GXSIM_VTX_10:
+            gx.vtx[0] = sign_extend(p[0] & 0x3FF, 10) << 6;
+            gx.vtx[1] = sign_extend((p[0] >> 10) & 0x3FF, 10) << 6;
+            gx.vtx[2] = sign_extend((p[0] >> 20) & 0x3FF, 10) << 6;
+            break;
+
+        case GXSIM_VTX_XY:
+            gx.vtx[0] = sign_extend(p[0] & 0xFFFF, 16);
+            gx.vtx[1] = sign_extend((uint32_t)p[0] >> 16, 16);
+            break;
+
+        case GXSIM_VTX_XZ:
+            gx.vtx[0] = sign_extend(p[0] & 0xFFFF, 16);
+            gx.vtx[2] = sign_extend((uint32_t)p[0] >> 16, 16);
+            break;
+
+        case GXSIM_VTX_YZ:
+            gx.vtx[1] = sign_extend(p[0] & 0xFFFF, 16);
+            gx.vtx[2] = sign_extend((uint32_t)p[0] >> 16, 16);
+            break;
+
+        case GXSIM_VTX_DIFF:
+            // The differences are added to the coordinates of the previous
+            // vertex, in units of 1/4096 (the same as in VTX_16).
+            gx.vtx[0] = sign_extend(gx.vtx[0] + sign_extend(p[0] & 0x3FF, 10), 16);
+            gx.vtx[1] = sign_extend(gx.vtx[1] + sign_extend((p[0] >> 10) & 0x3FF, 10), 16);
+            gx.vtx[2] = sign_extend(gx.vtx[2] + sign_extend((p[0] >> 20) & 0x3FF, 10), 16);
+            break;
+
+        case GXSIM_BEGIN_VTXS:
+            gx.poly_type = p[0] & 3;
+            gx.poly_vertices = 0;
+            break;
+
+        case GXSIM_BOX_TEST:
+            gx.box_test_result = box_test(p);
+            break;
+
+        default:
+            break;
+    }
+
+    if (is_vertex_command(e->cmd))
+    {
+        memcpy(e->vtx, gx.vtx, sizeof(e->vtx));
+        vertex_transform(gx.vtx, e->vtx_world);
+        polygon_add_vertex();
+    }
+}
+
+static void command_end(void)
+{
+    if (gx.mode == GXSIM_MODE_DISCARD)
+    {
+        // Only keep track of the stack pointer, the library needs it
+        if (gx.entry.cmd == GXSIM_MTX_PUSH)
+            gx.stack_pointer = (gx.stack_pointer + 1) & 63;
+        else if (gx.entry.cmd == GXSIM_MTX_POP)
+            gx.stack_pointer = (gx.stack_pointer - sign_extend(gx.entry.params[0], 6)) & 63;
+        return;
+    }
+
+    command_execute(&gx.entry);
+
+    if (gx.mode == GXSIM_MODE_RECORD)
+        log_append(&gx.entry);
+}
+
+static void command_start(uint32_t cmd)
+{
+    gx.cmd = cmd & 0xFF;
+    gx.entry.cmd = gx.cmd;
+    gx.entry.num_params = 0;
+    gx.cmd_params_left = command_info[gx.cmd].num_params;
+
+    if (gx.cmd_params_left == 0)
+        command_end();
+}
+
+static void command_param(uint32_t value)
+{
+    gx.entry.params[gx.entry.num_params++] = value;
+    gx.cmd_params_left--;
+
+    if (gx.cmd_params_left == 0)
+        command_end();
+}
+
+// Starts the next command of the packed command word being processed. Commands
+// without parameters are executed right away.
+static void fifo_next_command(void)
+{
+    while (gx.fifo_cmds_left > 0)
+    {
+        uint32_t cmd = gx.fifo_cmds & 0xFF;
+        gx.fifo_cmds >>= 8;
+        gx.fifo_cmds_left--;
+
+        // Packed NOPs are skipped, they are only used as padding
+        if (cmd == GXSIM_NOP)
+            continue;
+
+        command_start(cmd);
+        if (gx.cmd_params_left > 0)
+            return;
+    }
+}
+
+static void fifo_write(uint32_t value)
+{
+    if (gx.cmd_params_left > 0)
+    {
+        command_param(value);
+        if (gx.cmd_params_left == 0)
+            fifo_next_command();
+        return;
+    }
+
+    // This is a new packed command word
+    gx.fifo_cmds = value;
+    gx.fifo_cmds_left = 4;
+    fifo_next_command();
+}
+
+static void port_write(uint32_t port, uint32_t value)
+{
+    if (port == GXSIM_PORT_FIFO)
+    {
+        fifo_write(value);
+        return;
+    }
+
+    // Direct register writes. Commands without parameters accept one dummy
+    // write to trigger them.
+    if ((gx.cmd_params_left > 0) && (gx.cmd == port))
+    {
+        command_param(value);
+        return;
+    }
+
+    command_start(port);
+    if (gx.cmd_params_left > 0)
+        command_param(value);
+}
+
+// Public functions
+// ================
+
+void gxsim_reset(void)
+{
+    gx.pending = 0;
+    gx.cmd_params_left = 0;
+    gx.fifo_cmds_left = 0;
+
+    gx.matrix_mode = 0;
+    matrix_identity(&gx.projection);
+    matrix_identity(&gx.projection_stack);
+    matrix_identity(&gx.position);
+    matrix_identity(&gx.texture);
+    for (int i = 0; i < GXSIM_STACK_SIZE + 1; i++)
+        matrix_identity(&gx.position_stack[i]);
+    gx.stack_pointer = 0;
+    gx.stack_error = 0;
+
+    gx.poly_type = 0;
+    gx.poly_vertices = 0;
+    memset(gx.vtx, 0, sizeof(gx.vtx));
+    gx.polygon_count = 0;
+    gx.vertex_count = 0;
+
+    gx.box_test_result = 0;
+
+    gx.log_size = 0;
+}
+
+void gxsim_set_mode(gxsim_mode_t mode)
+{
+    gxsim_flush();
+    gx.mode = mode;
+}
+
+void gxsim_flush(void)
+{
+    if (gx.pending)
+    {
+        gx.pending = 0;
+        port_write(gx.pending_port, gx.pending_value);
+    }
+}
+
+uint32_t *gxsim_port(uint32_t port)
+{
+    gxsim_flush();
+
+    gx.pending = 1;
+    gx.pending_port = port;
+    gx.pending_value = 0;
+    return &gx.pending_value;
+}
+
+uint32_t gxsim_status(void)
+{
+    gxsim_flush();
+
+    // Push/pop operations are never busy, and the FIFO is never full.
+    uint32_t status = (gx.stack_pointer & 0x1F) << 8;
+    if (gx.stack_error)
+        status |= 1 << 15;
+
+    // FIFO empty
+    status |= 1 << 26;
+
+    // The box test is never busy. Matrices aren't tracked when commands are
+    // discarded, so boxes are always reported as visible.
+    if (gx.box_test_result || (gx.mode == GXSIM_MODE_DISCARD))
+        status |= 1 << 1;
+
+    return status;
+}
+
+uint32_t gxsim_polygon_count(void)
+{
+    gxsim_flush();
+    return gx.polygon_count;
+}
+
+uint32_t gxsim_vertex_count(void)
+{
+    gxsim_flush();
+    return gx.vertex_count;
+}
+
+void gxsim_call_list(const void *list)
+{
+    const uint32_t *ptr = list;
+    uint32_t count = *ptr++;
+
+    gxsim_flush();
+
+    // Display lists aren't expected to modify the matrix stack pointer, so
+    // there is nothing to do when commands are being discarded.
+    if (gx.mode == GXSIM_MODE_DISCARD)
+        return;
+
+    for (uint32_t i = 0; i < count; i++)
+        fifo_write(ptr[i]);
+}
@@ -0,0 +1,124 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2022 Antonio Niño Díaz <antonio_nd@outlook.com>
+
+// Software model of the parts of the DS geometry engine used by DSMA. It lets
+// the library be built and run on a regular host computer.
+
+#ifndef GXSIM_H__
+#define GXSIM_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Size of the position matrix stack of the real hardware.
+#define GXSIM_STACK_SIZE    31
+
+// Identifiers of the geometry commands (same values as the GX command IDs).
+#define GXSIM_NOP           0x00
+#define GXSIM_MTX_MODE      0x10
+#define GXSIM_MTX_PUSH      0x11
+#define GXSIM_MTX_POP       0x12
+#define GXSIM_MTX_STORE     0x13
+#define GXSIM_MTX_RESTORE   0x14
+#define GXSIM_MTX_IDENTITY  0x15
+#define GXSIM_MTX_LOAD_4x4  0x16
+#define GXSIM_MTX_LOAD_4x3  0x17
+#define GXSIM_MTX_MULT_4x4  0x18
+#define GXSIM_MTX_MULT_4x3  0x19
+#define GXSIM_MTX_MULT_3x3  0x1A
+#define GXSIM_MTX_SCALE     0x1B
+#define GXSIM_MTX_TRANS     0x1C
+#define GXSIM_COLOR         0x20
+#define GXSIM_NORMAL        0x21
+#define GXSIM_TEXCOORD      0x22
+#define GXSIM_VTX_16        0x23
+#define GXSIM_VTX_10        0x24
+#define GXSIM_VTX_XY        0x25
+#define GXSIM_VTX_XZ        0x26
+#define GXSIM_VTX_YZ        0x27
+#define GXSIM_VTX_DIFF      0x28
+#define GXSIM_POLYGON_ATTR  0x29
+#define GXSIM_TEXIMAGE      0x2A
+#define GXSIM_PLTT_BASE     0x2B
+#define GXSIM_DIF_AMB       0x30
+#define GXSIM_SPE_EMI       0x31
+#define GXSIM_LIGHT_VECTOR  0x32
+#define GXSIM_LIGHT_COLOR   0x33
+#define GXSIM_SHININESS     0x34
+#define GXSIM_BEGIN_VTXS    0x40
+#define GXSIM_END_VTXS      0x41
+#define GXSIM_SWAP_BUFFERS  0x50
+#define GXSIM_VIEWPORT      0x60
+#define GXSIM_BOX_TEST      0x70
+#define GXSIM_POS_TEST      0x71
+#define GXSIM_VEC_TEST      0x72
+
+// Pseudo-port used for writes to the packed command FIFO (GXFIFO).
+#define GXSIM_PORT_FIFO     0x100
+
+typedef enum {
+    // Only the matrix stack pointer is tracked, and display lists are ignored.
+    // Use it to measure the CPU cost of the library without the overhead of
+    // the simulation.
+    GXSIM_MODE_DISCARD,
+    // All commands are executed, but they aren't recorded.
+    GXSIM_MODE_EXECUTE,
+    // All commands are executed and recorded in the command log.
+    GXSIM_MODE_RECORD,
+} gxsim_mode_t;
+
+// Entry of the command log. Vertex commands also save the resulting vertex
+// after being transformed by the position matrix.
+typedef struct {
+    uint8_t cmd;
+    uint8_t num_params;
+    int32_t params[32];
+    int32_t vtx[3];       // Vertex in model space
+    int32_t vtx_world[3]; // Vertex transformed by the position matrix
+} gxsim_entry_t;
+
+// Resets the geometry engine state: identity matrices, empty stack and empty
+// command log. The mode is preserved.
+void gxsim_reset(void);
+
+void gxsim_set_mode(gxsim_mode_t mode);
+
+// Processes any register write that hasn't been processed yet. It needs to be
+// called before inspecting the state of the simulated hardware.
+void gxsim_flush(void);
+
+// Returns a pointer to a temporary location where the value of a register
+// write has to be stored. The write is processed the next time the simulator
+// is accessed.
+uint32_t *gxsim_port(uint32_t port);
+
+// Read-only registers.
+uint32_t gxsim_status(void);
+uint32_t gxsim_polygon_count(void);
+uint32_t gxsim_vertex_count(void);
+
+// Sends a display list (in the format used by glCallList()) to the FIFO.
+void gxsim_call_list(const void *list);
+
+// Access to the command log.
+size_t gxsim_log_size(void);
+const gxsim_entry_t *gxsim_log_entry(size_t index);
+void gxsim_log_clear(void);
+
+// Writes the command log as text, one command per line.
+void gxsim_log_dump(FILE *f);
+
+// Returns the name of a command ID, or NULL if it isn't a valid command.
+const char *gxsim_command_name(uint32_t cmd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // GXSIM_H__
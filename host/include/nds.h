@@ -0,0 +1,153 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2022 Antonio Niño Díaz <antonio_nd@outlook.com>
+
+// Minimal replacement of the libnds header used to build DSMA on a host
+// computer. Geometry engine registers are redirected to the simulator in
+// gxsim.c instead of being memory mapped.
+
+#ifndef HOST_NDS_H__
+#define HOST_NDS_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "gxsim.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef int8_t s8;
+typedef int16_t s16;
+typedef int32_t s32;
+
+typedef int32_t f32;
+typedef int16_t v16;
+typedef int16_t v10;
+typedef int16_t t16;
+
+// There is no ITCM or DTCM in the host, and the code can't be built as ARM.
+#define ITCM_CODE
+#define DTCM_DATA
+#define DTCM_BSS
+#define ARM_CODE
+
+#define BIT(n)              (1u << (n))
+
+#define inttof32(n)         ((int32_t)((n) * (1 << 12)))
+#define f32toint(n)         ((n) >> 12)
+#define floattof32(n)       ((int32_t)((n) * (1 << 12)))
+
+// Math coprocessor
+// ----------------
+
+// Same results as the hardware square root unit: the integer square root of a
+// 64-bit value, rounded down.
+static inline int32_t sqrtf32(int32_t a)
+{
+    uint64_t n = (uint64_t)(uint32_t)a << 12;
+    uint64_t res = 0;
+    uint64_t bit = 1ull << 62;
+
+    while (bit > n)
+        bit >>= 2;
+
+    while (bit != 0)
+    {
+        if (n >= res + bit)
+        {
+            n -= res + bit;
+            res = (res >> 1) + bit;
+        }
+        else
+        {
+            res >>= 1;
+        }
+        bit >>= 2;
+    }
+
+    return (int32_t)res;
+}
+
+// Same results as the hardware divider in 64 bit / 32 bit mode.
+static inline int32_t divf32(int32_t num, int32_t den)
+{
+    return (int32_t)(((int64_t)num << 12) / den);
+}
+
+// Geometry engine registers
+// -------------------------
+
+#define GFX_FIFO            (*gxsim_port(GXSIM_PORT_FIFO))
+
+#define MATRIX_CONTROL      (*gxsim_port(GXSIM_MTX_MODE))
+#define MATRIX_PUSH         (*gxsim_port(GXSIM_MTX_PUSH))
+#define MATRIX_POP          (*gxsim_port(GXSIM_MTX_POP))
+#define MATRIX_STORE        (*gxsim_port(GXSIM_MTX_STORE))
+#define MATRIX_RESTORE      (*gxsim_port(GXSIM_MTX_RESTORE))
+#define MATRIX_IDENTITY     (*gxsim_port(GXSIM_MTX_IDENTITY))
+#define MATRIX_LOAD4x4      (*gxsim_port(GXSIM_MTX_LOAD_4x4))
+#define MATRIX_LOAD4x3      (*gxsim_port(GXSIM_MTX_LOAD_4x3))
+#define MATRIX_MULT4x4      (*gxsim_port(GXSIM_MTX_MULT_4x4))
+#define MATRIX_MULT4x3      (*gxsim_port(GXSIM_MTX_MULT_4x3))
+#define MATRIX_MULT3x3      (*gxsim_port(GXSIM_MTX_MULT_3x3))
+#define MATRIX_SCALE        (*gxsim_port(GXSIM_MTX_SCALE))
+#define MATRIX_TRANSLATE    (*gxsim_port(GXSIM_MTX_TRANS))
+
+#define GFX_BOX_TEST        (*gxsim_port(GXSIM_BOX_TEST))
+#define GFX_STATUS          (gxsim_status())
+#define GFX_POLYGON_RAM_USAGE   (gxsim_polygon_count())
+#define GFX_VERTEX_RAM_USAGE    (gxsim_vertex_count())
+
+#define GL_PROJECTION       0
+#define GL_POSITION         1
+#define GL_MODELVIEW        2
+#define GL_TEXTURE          3
+
+#define GL_TRIANGLES        0
+#define GL_QUADS            1
+#define GL_TRIANGLE_STRIP   2
+#define GL_QUAD_STRIP       3
+
+static inline void glCallList(const void *list)
+{
+    gxsim_call_list(list);
+}
+
+static inline void glMatrixMode(int mode)
+{
+    MATRIX_CONTROL = mode;
+}
+
+static inline void glLoadIdentity(void)
+{
+    MATRIX_IDENTITY = 0;
+}
+
+static inline void glPushMatrix(void)
+{
+    MATRIX_PUSH = 0;
+}
+
+static inline void glPopMatrix(int num)
+{
+    MATRIX_POP = num;
+}
+
+static inline void glTranslatef32(int x, int y, int z)
+{
+    MATRIX_TRANSLATE = x;
+    MATRIX_TRANSLATE = y;
+    MATRIX_TRANSLATE = z;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HOST_NDS_H__
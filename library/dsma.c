@@ -16,6 +16,10 @@ typedef struct {
 
 #define DSA_VERSION_NUMBER 1
 
+// Flags stored in the upper bits of the version number of all DSA files.
+#define DSA_VERSION_MASK        0xFF
+#define DSA_FLAG_SNAP_FRAMES    BIT(8) // Round frames to the nearest integer
+
 // Format of a DSA file.
 typedef struct {
     uint32_t version;      // Version number
@@ -24,9 +28,250 @@ typedef struct {
     dsa_joint_t joints[0]; // Array of joints
 } dsa_t;
 
+// Format of a joint in a compact DSA file.
+typedef struct {
+    int16_t pos[3];    // Translation (x, y, z) in 4.12, shifted right by pos_shift
+    int16_t orient[4]; // Orientation (w, x, y, z) in 4.12
+} dsa_compact_joint_t;
+
+#define DSA_VERSION_COMPACT 2
+
+// Format of a compact DSA file. The header is the same as in regular DSA files
+// with some additional fields.
+//
+// Joints that have the same value in all frames (static joints) are only
+// stored once. The slot of a joint tells where to find it: if it's lower than
+// num_animated, it's the index of the joint in each frame. If not, it is a
+// static joint, and the index in the list of static joints is the slot minus
+// num_animated.
+//
+// The array of slots is padded to a multiple of 4 bytes. It's followed by the
+// static joints, and then by the frames, each one with num_animated joints.
+typedef struct {
+    uint32_t version;        // Version number
+    uint32_t num_frames;     // Frames in the file
+    uint32_t num_joints;     // Total number of joints
+    uint32_t pos_shift;      // Left shift to apply to all positions
+    uint32_t num_animated;   // Joints stored in each frame
+    uint8_t joint_slot[0];   // Slot of each joint
+} dsa_compact_t;
+
+// Key of a track of a DSA file with tracks.
+typedef struct {
+    uint16_t frame;    // Frame of the key
+    uint16_t inv_span; // 65536 / (frames until the next key), rounded, or 0
+                       // if the next key is in the next frame
+} dsa_key_t;
+
+// Track of keys of a joint of a DSA file with tracks. The keys are stored
+// first, followed by one compact joint per key.
+typedef struct {
+    uint16_t num_keys; // Number of keys of the track
+    uint16_t padding;
+    uint32_t offset;   // Offset from the start of the file to the keys
+} dsa_track_t;
+
+#define DSA_VERSION_TRACKS 3
+
+// Format of a DSA file with one track of keys per joint. The first key of each
+// track is always at frame 0. Animations loop, so the last key is interpolated
+// with the first one.
+typedef struct {
+    uint32_t version;      // Version number
+    uint32_t num_frames;   // Frames in the file
+    uint32_t num_joints;   // Number of joints (and tracks)
+    uint32_t pos_shift;    // Left shift to apply to all positions
+    dsa_track_t tracks[0]; // Array of tracks
+} dsa_tracks_t;
+
+#define DSA_VERSION_MATRICES 4
+
+// Format of a DSA file with the final matrix of each joint precomputed. Each
+// frame is a command list ready to be sent to the geometry engine with
+// glCallList(): the number of words of the list, followed by the same commands
+// as a command buffer (DSMA_CMD_WORDS_PER_JOINT words per joint). The matrix of
+// the model is restored from the slot right before the first joint.
+//
+// Skeletons that don't fit in the matrix stack (only drawn with segmented DSM
+// files) can't use the lists directly. Their matrices are read by the CPU.
+typedef struct {
+    uint32_t version;     // Version number
+    uint32_t num_frames;  // Frames in the file
+    uint32_t num_joints;  // Joints per frame
+    uint32_t frames[0];   // Command list of each frame
+} dsa_matrices_t;
+
+#define DSM_SEGMENTED_MAGIC 0x4D534453 // "SDSM"
+
+// Joint that has to be loaded to the matrix stack before drawing a segment.
+typedef struct {
+    uint8_t slot;  // Slot in the stack (relative to the first joint matrix)
+    uint8_t joint; // Index of the joint in the skeleton
+} dsm_load_t;
+
+// Segment of a segmented DSM file. The array of loads is padded to a multiple
+// of 4 bytes, and it's followed by the display list of the segment. Joints that
+// aren't loaded keep the matrix loaded by a previous segment.
+typedef struct {
+    uint32_t num_loads;  // Number of joints to load
+    dsm_load_t load[0];  // Joints to load
+} dsm_segment_t;
+
+// Format of a segmented DSM file. Regular DSM files are just a display list, so
+// the first word is the size of the list. The magic number is too big to be a
+// valid size.
+//
+// Each segment of the model uses at most segment_size joints, so skeletons that
+// don't fit in the matrix stack can still be drawn.
+typedef struct {
+    uint32_t magic;        // DSM_SEGMENTED_MAGIC
+    uint32_t num_segments; // Number of segments
+    uint32_t segment_size; // Max number of joints used by a segment
+    uint32_t num_joints;   // Number of joints of the skeleton
+    uint32_t offset[0];    // Offset to each segment from the start of the file
+} dsm_segmented_t;
+
+#define DSM_BAKED_MAGIC 0x4D534442 // "BDSM"
+
+// Format of a baked DSM file. It has one display list per frame of an
+// animation, with the model already deformed by the skeleton. Frames that are
+// identical share the same display list. The number of frames is in the same
+// place as in DSA files.
+typedef struct {
+    uint32_t magic;      // DSM_BAKED_MAGIC
+    uint32_t num_frames; // Frames in the file
+    uint32_t offset[0];  // Offset to each display list from the start of the file
+} dsm_baked_t;
+
+#define DSA_BOUNDS_MAGIC 0x42415344 // "DSAB"
+
+// Format of a bounds file. It has the bounding box of a model animated by a DSA
+// file in each frame of the animation. The box of a frame contains the model in
+// all the points between that frame and the next one. The number of frames is
+// in the same place as in DSA files.
+//
+// The boxes are stored as the 3 parameters of the BOX_TEST command. They are
+// shifted right by pos_shift so that big animated models fit in 16 bits.
+typedef struct {
+    uint32_t magic;      // DSA_BOUNDS_MAGIC
+    uint32_t num_frames; // Frames in the file
+    uint32_t pos_shift;  // Left shift to apply to the boxes
+    uint32_t box[0][3];  // Box of each frame
+} dsa_bounds_t;
+
+// Max value of pos_shift in a bounds file
+#define DSA_BOUNDS_MAX_SHIFT 12
+
+#define DSMA_CONTAINER_MAGIC 0x434D5344 // "DSMC"
+
+// Entry of the index of a container file.
+typedef struct {
+    uint32_t name_hash; // DSMA_HashName() of the name of the file
+    uint32_t offset;    // Offset to the file from the start of the container
+} dsma_container_entry_t;
+
+// Format of a container file. It holds several DSM and DSA files, which can be
+// used directly from the container. The index is sorted by name hash.
+//
+// Files with the same contents are only stored once. The tracks of DSA files
+// with tracks (version 3) are stored after all the files, and identical tracks
+// are only stored once, even if they belong to different animations. The
+// offsets of the tracks are relative to the start of each DSA file, as usual.
+typedef struct {
+    uint32_t magic;                   // DSMA_CONTAINER_MAGIC
+    uint32_t num_files;               // Number of entries in the index
+    dsma_container_entry_t entry[0];  // Index of files
+} dsma_container_t;
+
+// Format of a pose buffer. It holds the final matrix of each joint.
+typedef struct {
+    uint32_t num_joints;
+    int32_t matrix[0][12];
+} dsma_pose_t;
+
+// Max number of joints that can fit in the matrix stack. The first slot of the
+// stack is always reserved for the matrix of the model.
+#define DSMA_MAX_JOINTS 30
+
+// Number of instances grouped at a time by DSMA_DrawModelInstances().
+#define DSMA_INSTANCES_PER_BATCH 64
+
+// IDs of the geometry engine commands written to command buffers.
+#define GX_CMD_NOP          0x00
+#define GX_CMD_MTX_STORE    0x13
+#define GX_CMD_MTX_RESTORE  0x14
+#define GX_CMD_MTX_MULT_4x3 0x19
+#define GX_CMD_VTX_16       0x23
+#define GX_CMD_VTX_DIFF     0x28
+#define GX_CMD_BEGIN_VTXS   0x40
+#define GX_CMD_END_VTXS     0x41
+
+#define GX_CMD_PACK(c1, c2, c3, c4) \
+    (((c4) << 24) | ((c3) << 16) | ((c2) << 8) | (c1))
+
+// Words used by each joint in a command buffer: one word with the packed IDs of
+// the commands (MTX_RESTORE, MTX_MULT_4x3, MTX_STORE and NOP), followed by 14
+// words of parameters.
+#define DSMA_CMD_WORDS_PER_JOINT 15
+
+// Command buffer set by DSMA_SetCommandBuffer(), or NULL if the matrices of the
+// joints are written to the geometry engine registers directly.
+static uint32_t *dsma_cmd_buffer = NULL;
+static size_t dsma_cmd_buffer_size = 0;
+
+// Interpolation quality set by DSMA_SetInterpolationQuality().
+static uint32_t dsma_interp_quality = DSMA_INTERPOLATION_FAST;
+
+#ifdef DSMA_STATS
+// Counters returned by DSMA_GetStats(), and clock set by DSMA_SetStatsClock().
+static DSMA_Stats dsma_stats;
+static DSMA_StatsClockFn dsma_stats_clock = NULL;
+# define DSMA_STATS_ADD(field, value)   (dsma_stats.field += (value))
+#else
+# define DSMA_STATS_ADD(field, value)   ((void)0)
+#endif
+
 // Private functions
 // =================
 
+// Counts a frame of an animation read by the library.
+ITCM_CODE ARM_CODE static inline
+void stats_count_frame(uint32_t interp)
+{
+    if (interp == 0)
+        DSMA_STATS_ADD(frames_exact, 1);
+    else
+        DSMA_STATS_ADD(frames_interpolated, 1);
+}
+
+// Waits until all the matrix push and pop operations of the geometry engine
+// have ended.
+ITCM_CODE ARM_CODE static inline
+void gx_wait_matrix_stack(void)
+{
+#ifdef DSMA_STATS
+    DSMA_StatsClockFn clock = dsma_stats_clock;
+    uint32_t start = (clock != NULL) ? clock() : 0;
+
+    while (GFX_STATUS & BIT(14))
+        dsma_stats.stack_wait_polls++;
+
+    if (clock != NULL)
+        dsma_stats.stack_wait_ticks += clock() - start;
+#else
+    while (GFX_STATUS & BIT(14));
+#endif
+}
+
+// Sends a list of commands to the geometry engine with a DMA copy. The first
+// word of the list is the number of words that follow it.
+ITCM_CODE ARM_CODE static inline
+void gx_call_list(const uint32_t *list)
+{
+    DSMA_STATS_ADD(gx_words_dma, list[0]);
+    glCallList(list);
+}
+
 // Helper that multiplies two fixed point values in 20.12 format and multiplies
 // the result again by 2.
 ITCM_CODE ARM_CODE static inline
@@ -41,6 +286,8 @@ int32_t mulf32_by_2(int32_t a, int32_t b)
 ITCM_CODE ARM_CODE static inline
 void matrix_mult_by_joint(const int32_t *v, const int32_t *q)
 {
+    DSMA_STATS_ADD(joints_evaluated, 1);
+
     int32_t wx = mulf32_by_2(q[0], q[1]);
     int32_t wy = mulf32_by_2(q[0], q[2]);
     int32_t wz = mulf32_by_2(q[0], q[3]);
@@ -68,6 +315,170 @@ void matrix_mult_by_joint(const int32_t *v, const int32_t *q)
     MATRIX_MULT4x3 = v[2];
 }
 
+// Generates the same 4x3 matrix as matrix_mult_by_joint(), but it stores it in
+// the provided array instead of sending it to the geometry engine.
+ITCM_CODE ARM_CODE static inline
+void matrix_from_joint(const int32_t *v, const int32_t *q, int32_t *m)
+{
+    DSMA_STATS_ADD(joints_evaluated, 1);
+
+    int32_t wx = mulf32_by_2(q[0], q[1]);
+    int32_t wy = mulf32_by_2(q[0], q[2]);
+    int32_t wz = mulf32_by_2(q[0], q[3]);
+    int32_t x2 = mulf32_by_2(q[1], q[1]);
+    int32_t xy = mulf32_by_2(q[1], q[2]);
+    int32_t xz = mulf32_by_2(q[1], q[3]);
+    int32_t y2 = mulf32_by_2(q[2], q[2]);
+    int32_t yz = mulf32_by_2(q[2], q[3]);
+    int32_t z2 = mulf32_by_2(q[3], q[3]);
+
+    m[0] = inttof32(1) - y2 - z2;
+    m[1] = xy + wz;
+    m[2] = xz - wy;
+
+    m[3] = xy - wz;
+    m[4] = inttof32(1) - x2 - z2;
+    m[5] = yz + wx;
+
+    m[6] = xz + wy;
+    m[7] = yz - wx;
+    m[8] = inttof32(1) - x2 - y2;
+
+    m[9] = v[0];
+    m[10] = v[1];
+    m[11] = v[2];
+}
+
+// Multiplies the matrix that is currently active in the geometry engine by the
+// provided 4x3 matrix.
+ITCM_CODE ARM_CODE static inline
+void matrix_mult_4x3(const int32_t *m)
+{
+    MATRIX_MULT4x3 = m[0];
+    MATRIX_MULT4x3 = m[1];
+    MATRIX_MULT4x3 = m[2];
+    MATRIX_MULT4x3 = m[3];
+    MATRIX_MULT4x3 = m[4];
+    MATRIX_MULT4x3 = m[5];
+    MATRIX_MULT4x3 = m[6];
+    MATRIX_MULT4x3 = m[7];
+    MATRIX_MULT4x3 = m[8];
+    MATRIX_MULT4x3 = m[9];
+    MATRIX_MULT4x3 = m[10];
+    MATRIX_MULT4x3 = m[11];
+}
+
+// Helper used to send the matrices of the joints of a model to the geometry
+// engine. If a command buffer has been set, the commands are written to it and
+// sent with a DMA copy when all of them are ready. If not, they are written to
+// the registers of the geometry engine right away.
+typedef struct {
+    uint32_t *cmd;          // Next joint in the command buffer, or NULL
+    uint32_t restore_level; // Matrix of the model in the stack
+    uint32_t base_matrix;   // Matrix of the first joint in the stack
+} joint_writer_t;
+
+// Prepares a writer for a model with the specified number of joints. It returns
+// a DSMA_* code (0 for success).
+ITCM_CODE ARM_CODE static inline
+int joint_writer_init(joint_writer_t *writer, uint32_t num_joints)
+{
+    writer->cmd = NULL;
+
+    if (dsma_cmd_buffer == NULL)
+        return DSMA_SUCCESS;
+
+    if (dsma_cmd_buffer_size < DSMA_COMMAND_BUFFER_SIZE(num_joints))
+        return DSMA_COMMAND_BUFFER_TOO_SMALL;
+
+    // Leave space for the size of the list
+    writer->cmd = dsma_cmd_buffer + 1;
+
+    return DSMA_SUCCESS;
+}
+
+// Sets the location of the matrices in the stack. It must be called before
+// writing any joint.
+ITCM_CODE ARM_CODE static inline
+void joint_writer_set_levels(joint_writer_t *writer, uint32_t restore_level,
+                             uint32_t base_matrix)
+{
+    writer->restore_level = restore_level;
+    writer->base_matrix = base_matrix;
+}
+
+// Returns a pointer to the 12 words where the matrix of the specified joint has
+// to be written in the command buffer.
+ITCM_CODE ARM_CODE static inline
+int32_t *joint_writer_get_matrix(joint_writer_t *writer, uint32_t index)
+{
+    uint32_t *cmd = writer->cmd;
+
+    cmd[0] = GX_CMD_PACK(GX_CMD_MTX_RESTORE, GX_CMD_MTX_MULT_4x3,
+                         GX_CMD_MTX_STORE, GX_CMD_NOP);
+    cmd[1] = writer->restore_level;
+    cmd[14] = writer->base_matrix + index;
+
+    writer->cmd = cmd + DSMA_CMD_WORDS_PER_JOINT;
+
+    return (int32_t *)&cmd[2];
+}
+
+// Sends the matrix of a joint generated from its position and orientation.
+ITCM_CODE ARM_CODE static inline
+void joint_writer_add_joint(joint_writer_t *writer, uint32_t index,
+                            const int32_t *v, const int32_t *q)
+{
+    if (writer->cmd == NULL)
+    {
+        DSMA_STATS_ADD(gx_words_cpu, 14);
+
+        // Generate new matrix
+        MATRIX_RESTORE = writer->restore_level;
+        matrix_mult_by_joint(v, q);
+
+        // Store it in the right position in the stack
+        MATRIX_STORE = writer->base_matrix + index;
+        return;
+    }
+
+    matrix_from_joint(v, q, joint_writer_get_matrix(writer, index));
+}
+
+// Sends the matrix of a joint that has already been calculated.
+ITCM_CODE ARM_CODE static inline
+void joint_writer_add_matrix(joint_writer_t *writer, uint32_t index,
+                             const int32_t *m)
+{
+    if (writer->cmd == NULL)
+    {
+        DSMA_STATS_ADD(gx_words_cpu, 14);
+
+        MATRIX_RESTORE = writer->restore_level;
+        matrix_mult_4x3(m);
+        MATRIX_STORE = writer->base_matrix + index;
+        return;
+    }
+
+    int32_t *dest = joint_writer_get_matrix(writer, index);
+    for (int i = 0; i < 12; i++)
+        dest[i] = m[i];
+}
+
+// Sends all the commands written to the command buffer to the geometry engine,
+// if any. After this, the writer can be used again for a new set of joints.
+ITCM_CODE ARM_CODE static inline
+void joint_writer_flush(joint_writer_t *writer)
+{
+    if (writer->cmd == NULL)
+        return;
+
+    dsma_cmd_buffer[0] = writer->cmd - dsma_cmd_buffer - 1;
+    gx_call_list(dsma_cmd_buffer);
+
+    writer->cmd = dsma_cmd_buffer + 1;
+}
+
 // Gets a pointer to the list of joints of the specified frame.
 ITCM_CODE ARM_CODE static inline
 const dsa_joint_t *dsa_get_frame(const dsa_t *dsa, uint32_t frame)
@@ -75,6 +486,41 @@ const dsa_joint_t *dsa_get_frame(const dsa_t *dsa, uint32_t frame)
     return &dsa->joints[frame * dsa->num_joints];
 }
 
+// Gets a pointer to the list of static joints of a compact DSA file.
+ITCM_CODE ARM_CODE static inline
+const dsa_compact_joint_t *dsa_compact_get_static_joints(const dsa_compact_t *dsa)
+{
+    uint32_t slots_size = (dsa->num_joints + 3) & ~3;
+    return (const dsa_compact_joint_t *)&dsa->joint_slot[slots_size];
+}
+
+// Gets a pointer to the list of animated joints of the specified frame of a
+// compact DSA file.
+ITCM_CODE ARM_CODE static inline
+const dsa_compact_joint_t *dsa_compact_get_frame(const dsa_compact_t *dsa,
+                                                 uint32_t frame)
+{
+    const dsa_compact_joint_t *static_joints = dsa_compact_get_static_joints(dsa);
+    uint32_t num_static = dsa->num_joints - dsa->num_animated;
+    return &static_joints[num_static + frame * dsa->num_animated];
+}
+
+// Expands a joint of a compact DSA file to 20.12 values.
+ITCM_CODE ARM_CODE static inline
+void dsa_compact_unpack_joint(const dsa_compact_joint_t *joint,
+                              uint32_t pos_shift,
+                              int32_t *v_pos, int32_t *q_orient)
+{
+    v_pos[0] = joint->pos[0] << pos_shift;
+    v_pos[1] = joint->pos[1] << pos_shift;
+    v_pos[2] = joint->pos[2] << pos_shift;
+
+    q_orient[0] = joint->orient[0];
+    q_orient[1] = joint->orient[1];
+    q_orient[2] = joint->orient[2];
+    q_orient[3] = joint->orient[3];
+}
+
 // Interpolates linearly between 'start' and 'end'. The position is a floating
 // point number in 20.12 format, and it should be between 0.0 and 1.0 (the
 // function doesn't check bounds).
@@ -85,6 +531,73 @@ int32_t lerp(int32_t start, int32_t end, int32_t pos)
     return start + ((diff * pos) >> 12);
 }
 
+// Approximation of 1 / sqrt(x) for x between 0.25 and 1.0, in 20.12 format.
+// Entry i is the value in the middle of [0.25 + i / 64, 0.25 + (i + 1) / 64).
+static const int16_t rsqrt_table[48] = {
+    8067, 7833, 7618, 7420, 7237, 7067, 6908, 6760,
+    6620, 6489, 6365, 6249, 6138, 6033, 5933, 5838,
+    5748, 5661, 5579, 5500, 5424, 5351, 5281, 5214,
+    5149, 5087, 5026, 4968, 4912, 4858, 4805, 4754,
+    4705, 4657, 4611, 4566, 4522, 4480, 4439, 4398,
+    4359, 4321, 4284, 4248, 4213, 4178, 4145, 4112,
+};
+
+// Returns an approximation of 1 / sqrt(n). Both values are in 20.12 format,
+// and 'n' must be positive. The value is looked up in a table and refined with
+// one iteration of Newton's method, which is enough for 12 fractional bits.
+ITCM_CODE ARM_CODE static inline
+int32_t rsqrt_approx(int32_t n)
+{
+    // Bring the value to the range of the table. It is multiplied or divided
+    // by powers of 4 so that the result only needs to be shifted by 1 bit for
+    // each one of them.
+    int32_t shift = 0;
+
+    while (n >= inttof32(1))
+    {
+        n >>= 2;
+        shift++;
+    }
+    while (n < inttof32(1) / 4)
+    {
+        n <<= 2;
+        shift--;
+    }
+
+    int32_t r = rsqrt_table[(n - inttof32(1) / 4) >> 6];
+
+    // r = r * (3 - n * r * r) / 2
+    int32_t nr2 = (n * ((r * r) >> 12)) >> 12;
+    r = (r * (inttof32(3) - nr2)) >> 13;
+
+    if (shift > 0)
+        return r >> shift;
+    else
+        return r << -shift;
+}
+
+// Normalizes the provided quaternion in place with the method selected with
+// DSMA_SetInterpolationQuality().
+ITCM_CODE ARM_CODE static inline
+void q_normalize(int32_t *q)
+{
+    int32_t n = (q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]) >> 12;
+    if (n <= 0)
+        return;
+
+    int32_t inv_len;
+
+    if (dsma_interp_quality == DSMA_INTERPOLATION_NORMALIZED_EXACT)
+        inv_len = divf32(inttof32(1), sqrtf32(n));
+    else
+        inv_len = rsqrt_approx(n);
+
+    q[0] = (q[0] * inv_len) >> 12;
+    q[1] = (q[1] * inv_len) >> 12;
+    q[2] = (q[2] * inv_len) >> 12;
+    q[3] = (q[3] * inv_len) >> 12;
+}
+
 // Interpolates between quaternions 'q1' and 'q2. The position is a floating
 // point number in 20.12 format, and it should be between 0.0 and 1.0 (the
 // function doesn't check bounds). It stores the result in 'qdest'.
@@ -96,9 +609,8 @@ void q_nlerp(const int32_t *q1, const int32_t *q2, int32_t pos, int32_t *qdest)
     qdest[2] = lerp(q1[2], q2[2], pos);
     qdest[3] = lerp(q1[3], q2[3], pos);
 
-    // TODO: Normalize? It needs way too much CPU time (at least we need one
-    // square root and one division), but it may be needed in the future if the
-    // animations look bad. Maybe it can be optional.
+    if (dsma_interp_quality != DSMA_INTERPOLATION_FAST)
+        q_normalize(qdest);
 }
 
 // Interpolate between two positions and two orientations.
@@ -114,103 +626,1545 @@ void dsa_interpolate_frames(const int32_t *v_pos_1, const int32_t *q_orient_1,
     q_nlerp(q_orient_1, q_orient_2, interp, q_orient);
 }
 
-// Public functions
-// ================
+// Samples the track of the specified joint of a DSA file with tracks at the
+// requested frame (in 20.12 format). The frame must be valid.
+ITCM_CODE ARM_CODE static inline
+void dsa_track_sample(const dsa_tracks_t *dsa, uint32_t index,
+                      uint32_t frame_interp, int32_t *v_pos, int32_t *q_orient)
+{
+    const dsa_track_t *track = &dsa->tracks[index];
+    const dsa_key_t *keys = (const dsa_key_t *)((uintptr_t)dsa + track->offset);
+    uint32_t num_keys = track->num_keys;
+    const dsa_compact_joint_t *joints = (const dsa_compact_joint_t *)&keys[num_keys];
 
-uint32_t DSMA_GetNumFrames(const void *dsa_file)
+    // Look for the last key that isn't after the requested frame
+    uint32_t frame = frame_interp >> 12;
+    uint32_t low = 0;
+    uint32_t high = num_keys;
+    while (high - low > 1)
+    {
+        uint32_t mid = (low + high) >> 1;
+        if (keys[mid].frame <= frame)
+            low = mid;
+        else
+            high = mid;
+    }
+
+    uint32_t pos_shift = dsa->pos_shift;
+    uint32_t local = frame_interp - (keys[low].frame << 12);
+
+    if ((local == 0) || (num_keys == 1))
+    {
+        dsa_compact_unpack_joint(&joints[low], pos_shift, v_pos, q_orient);
+        return;
+    }
+
+    uint32_t next = low + 1;
+    if (next == num_keys)
+        next = 0;
+
+    uint32_t inv_span = keys[low].inv_span;
+    uint32_t interp;
+    if (inv_span == 0)
+        interp = local; // The next key is in the next frame
+    else
+        interp = (local * inv_span + (1 << 15)) >> 16;
+
+    int32_t v_pos_1[3], v_pos_2[3];
+    int32_t q_orient_1[4], q_orient_2[4];
+
+    dsa_compact_unpack_joint(&joints[low], pos_shift, &v_pos_1[0], &q_orient_1[0]);
+    dsa_compact_unpack_joint(&joints[next], pos_shift, &v_pos_2[0], &q_orient_2[0]);
+
+    dsa_interpolate_frames(&v_pos_1[0], &q_orient_1[0],
+                           &v_pos_2[0], &q_orient_2[0],
+                           interp, v_pos, q_orient);
+}
+
+// Gets a pointer to the command list of the specified frame of a DSA file with
+// matrices.
+ITCM_CODE ARM_CODE static inline
+const uint32_t *dsa_matrices_get_frame(const dsa_matrices_t *dsa, uint32_t frame)
 {
-    const dsa_t *dsa = dsa_file;
-    return dsa->num_frames;
+    uint32_t frame_size = 1 + dsa->num_joints * DSMA_CMD_WORDS_PER_JOINT;
+    return &dsa->frames[frame * frame_size];
 }
 
-ITCM_CODE ARM_CODE
-int DSMA_DrawModel(const void *dsm_file, const void *dsa_file, uint32_t frame_interp)
+// Gets a pointer to the matrix of the specified joint in the command list of a
+// frame of a DSA file with matrices.
+ITCM_CODE ARM_CODE static inline
+const int32_t *dsa_matrices_get_matrix(const uint32_t *frame_list, uint32_t index)
+{
+    // Skip the size of the list, the packed commands and the MTX_RESTORE level
+    return (const int32_t *)&frame_list[1 + index * DSMA_CMD_WORDS_PER_JOINT + 2];
+}
+
+// Interpolates linearly between two matrices. It is much cheaper than
+// interpolating the joints and generating the matrix again, and the result is
+// very similar when the frames are close.
+ITCM_CODE ARM_CODE static inline
+void matrix_lerp(const int32_t *m1, const int32_t *m2, int32_t pos, int32_t *m)
+{
+    for (int i = 0; i < 12; i++)
+        m[i] = m1[i] + (((m2[i] - m1[i]) * pos) >> 12);
+}
+
+// Returns the version of a DSA file without its flags.
+ITCM_CODE ARM_CODE static inline
+uint32_t dsa_get_version(const dsa_t *dsa)
+{
+    return dsa->version & DSA_VERSION_MASK;
+}
+
+// Returns the frame of a DSA file that has to be used for the requested frame.
+// Files exported with a frame rate that matches the one of the game have the
+// snap flag set, and their frames are rounded to the nearest integer so that
+// they are never interpolated. Invalid frames aren't modified.
+ITCM_CODE ARM_CODE static inline
+uint32_t dsa_snap_frame(const dsa_t *dsa, uint32_t frame_interp)
+{
+    if ((dsa->version & DSA_FLAG_SNAP_FRAMES) == 0)
+        return frame_interp;
+
+    uint32_t num_frames = dsa->num_frames;
+    if ((frame_interp >> 12) >= num_frames)
+        return frame_interp;
+
+    uint32_t frame = (frame_interp + (1 << 11)) >> 12;
+    if (frame == num_frames)
+        frame = 0;
+
+    return frame << 12;
+}
+
+// Returns true if the version of the DSA file is supported by the library.
+ITCM_CODE ARM_CODE static inline
+bool dsa_is_version_valid(const dsa_t *dsa)
+{
+    uint32_t version = dsa_get_version(dsa);
+
+    return (version == DSA_VERSION_NUMBER) ||
+           (version == DSA_VERSION_COMPACT) ||
+           (version == DSA_VERSION_TRACKS);
+}
+
+// State needed to read the joints of a DSA file of any version at a specific
+// frame.
+typedef struct {
+    const dsa_t *dsa;
+    uint32_t frame_interp;
+    uint32_t interp;
+    const void *frame_ptr_1; // Current frame (formats with full frames)
+    const void *frame_ptr_2; // Next frame (formats with full frames)
+    const void *static_ptr;  // Static joints (compact format)
+} dsa_sampler_t;
+
+// Prepares a sampler to read joints from a DSA file at the specified frame. It
+// returns a DSMA_* code (0 for success).
+ITCM_CODE ARM_CODE static inline
+int dsa_sampler_init(dsa_sampler_t *sampler, const void *dsa_file,
+                     uint32_t frame_interp)
 {
     const dsa_t *dsa = dsa_file;
 
-    if (dsa->version != DSA_VERSION_NUMBER)
+    if (!dsa_is_version_valid(dsa) &&
+        (dsa_get_version(dsa) != DSA_VERSION_MATRICES))
         return DSMA_INVALID_VERSION;
 
-    uint32_t num_joints = dsa->num_joints;
+    frame_interp = dsa_snap_frame(dsa, frame_interp);
+
     uint32_t num_frames = dsa->num_frames;
 
     uint32_t frame = frame_interp >> 12;
-    uint32_t interp = frame_interp & 0xFFF;
-
     if (frame >= num_frames)
         return DSMA_INVALID_FRAME;
 
-    // Make sure that there is enough space in the matrix stack
-    // --------------------------------------------------------
-
-    uint32_t base_matrix = 30 - num_joints + 1;
+    uint32_t next_frame = frame + 1;
+    if (next_frame == num_frames)
+        next_frame = 0;
 
-    // Wait for matrix push/pop operations to end
-    while (GFX_STATUS & BIT(14));
+    sampler->dsa = dsa;
+    sampler->frame_interp = frame_interp;
+    sampler->interp = frame_interp & 0xFFF;
 
-    uint32_t curr_stack_level = (GFX_STATUS >> 8) & 0x1F;
-    if (curr_stack_level >= base_matrix)
-        return DSMA_MATRIX_STACK_FULL;
+    if (dsa_get_version(dsa) == DSA_VERSION_COMPACT)
+    {
+        const dsa_compact_t *dsa_compact = dsa_file;
+        sampler->frame_ptr_1 = dsa_compact_get_frame(dsa_compact, frame);
+        sampler->frame_ptr_2 = dsa_compact_get_frame(dsa_compact, next_frame);
+        sampler->static_ptr = dsa_compact_get_static_joints(dsa_compact);
+    }
+    else if (dsa_get_version(dsa) == DSA_VERSION_NUMBER)
+    {
+        sampler->frame_ptr_1 = dsa_get_frame(dsa, frame);
+        sampler->frame_ptr_2 = dsa_get_frame(dsa, next_frame);
+    }
+    else if (dsa_get_version(dsa) == DSA_VERSION_MATRICES)
+    {
+        const dsa_matrices_t *dsa_matrices = dsa_file;
+        sampler->frame_ptr_1 = dsa_matrices_get_frame(dsa_matrices, frame);
+        sampler->frame_ptr_2 = dsa_matrices_get_frame(dsa_matrices, next_frame);
+    }
 
-    MATRIX_PUSH = 0;
+    return DSMA_SUCCESS;
+}
 
-    // Generate matrices with bone transformations
-    // -------------------------------------------
+// Reads the joint with the specified index, interpolated if required.
+ITCM_CODE ARM_CODE static inline
+void dsa_sampler_get_joint(const dsa_sampler_t *sampler, uint32_t index,
+                           int32_t *v_pos, int32_t *q_orient)
+{
+    const dsa_t *dsa = sampler->dsa;
+    uint32_t interp = sampler->interp;
 
-    if (interp != 0)
+    if (dsa_get_version(dsa) == DSA_VERSION_TRACKS)
     {
-        uint32_t next_frame = frame + 1;
-        if (next_frame == num_frames)
-            next_frame = 0;
-
-        const dsa_joint_t *frame_ptr_1 = dsa_get_frame(dsa, frame);
-        const dsa_joint_t *frame_ptr_2 = dsa_get_frame(dsa, next_frame);
+        dsa_track_sample((const dsa_tracks_t *)dsa, index,
+                         sampler->frame_interp, v_pos, q_orient);
+    }
+    else if (dsa_get_version(dsa) == DSA_VERSION_COMPACT)
+    {
+        const dsa_compact_t *dsa_compact = (const dsa_compact_t *)dsa;
+        uint32_t pos_shift = dsa_compact->pos_shift;
+        uint32_t num_animated = dsa_compact->num_animated;
+        uint32_t slot = dsa_compact->joint_slot[index];
 
-        for (uint32_t i = 0; i < num_joints; i++)
+        if (slot >= num_animated)
         {
-            int32_t v_pos[3];
-            int32_t q_orient[4];
+            const dsa_compact_joint_t *joint = sampler->static_ptr;
+            dsa_compact_unpack_joint(&joint[slot - num_animated], pos_shift,
+                                     v_pos, q_orient);
+            return;
+        }
 
-            dsa_interpolate_frames(&frame_ptr_1->pos[0],
-                                   &frame_ptr_1->orient[0],
-                                   &frame_ptr_2->pos[0],
-                                   &frame_ptr_2->orient[0],
-                                   interp, &v_pos[0], &q_orient[0]);
-            frame_ptr_1++;
-            frame_ptr_2++;
+        const dsa_compact_joint_t *joint_1 = sampler->frame_ptr_1;
+        const dsa_compact_joint_t *joint_2 = sampler->frame_ptr_2;
 
-            // Generate new matrix
-            MATRIX_RESTORE = curr_stack_level;
-            matrix_mult_by_joint(v_pos, q_orient);
+        if (interp == 0)
+        {
+            dsa_compact_unpack_joint(&joint_1[slot], pos_shift, v_pos, q_orient);
+            return;
+        }
+
+        int32_t v_pos_1[3], v_pos_2[3];
+        int32_t q_orient_1[4], q_orient_2[4];
+
+        dsa_compact_unpack_joint(&joint_1[slot], pos_shift,
+                                 &v_pos_1[0], &q_orient_1[0]);
+        dsa_compact_unpack_joint(&joint_2[slot], pos_shift,
+                                 &v_pos_2[0], &q_orient_2[0]);
+
+        dsa_interpolate_frames(&v_pos_1[0], &q_orient_1[0],
+                               &v_pos_2[0], &q_orient_2[0],
+                               interp, v_pos, q_orient);
+    }
+    else
+    {
+        const dsa_joint_t *joint_1 = sampler->frame_ptr_1;
+        const dsa_joint_t *joint_2 = sampler->frame_ptr_2;
+        joint_1 += index;
+        joint_2 += index;
+
+        if (interp == 0)
+        {
+            v_pos[0] = joint_1->pos[0];
+            v_pos[1] = joint_1->pos[1];
+            v_pos[2] = joint_1->pos[2];
+
+            q_orient[0] = joint_1->orient[0];
+            q_orient[1] = joint_1->orient[1];
+            q_orient[2] = joint_1->orient[2];
+            q_orient[3] = joint_1->orient[3];
+            return;
+        }
+
+        dsa_interpolate_frames(&joint_1->pos[0], &joint_1->orient[0],
+                               &joint_2->pos[0], &joint_2->orient[0],
+                               interp, v_pos, q_orient);
+    }
+}
+
+// Reads the final matrix of the joint with the specified index, interpolated if
+// required. This is the only way to read joints from DSA files with matrices.
+ITCM_CODE ARM_CODE static inline
+void dsa_sampler_get_matrix(const dsa_sampler_t *sampler, uint32_t index,
+                            int32_t *m)
+{
+    if (dsa_get_version(sampler->dsa) == DSA_VERSION_MATRICES)
+    {
+        DSMA_STATS_ADD(joints_evaluated, 1);
+
+        const int32_t *m1 = dsa_matrices_get_matrix(sampler->frame_ptr_1, index);
+
+        if (sampler->interp == 0)
+        {
+            for (int i = 0; i < 12; i++)
+                m[i] = m1[i];
+            return;
+        }
+
+        const int32_t *m2 = dsa_matrices_get_matrix(sampler->frame_ptr_2, index);
+        matrix_lerp(m1, m2, sampler->interp, m);
+        return;
+    }
+
+    int32_t v_pos[3];
+    int32_t q_orient[4];
+
+    dsa_sampler_get_joint(sampler, index, &v_pos[0], &q_orient[0]);
+
+    matrix_from_joint(v_pos, q_orient, m);
+}
+
+// Reads the joint with the specified index of two animations and blends them
+// with the specified factor. Animations that don't contribute to the result
+// aren't sampled.
+ITCM_CODE ARM_CODE static inline
+void dsa_blend_two_joints(const dsa_sampler_t *sampler_1,
+                          const dsa_sampler_t *sampler_2,
+                          uint32_t index, uint32_t blend,
+                          int32_t *v_pos, int32_t *q_orient)
+{
+    if (blend == 0)
+    {
+        dsa_sampler_get_joint(sampler_1, index, v_pos, q_orient);
+        return;
+    }
+
+    if (blend == inttof32(1))
+    {
+        dsa_sampler_get_joint(sampler_2, index, v_pos, q_orient);
+        return;
+    }
+
+    int32_t v_pos_1[3];
+    int32_t q_orient_1[4];
+
+    dsa_sampler_get_joint(sampler_1, index, &v_pos_1[0], &q_orient_1[0]);
+
+    int32_t v_pos_2[3];
+    int32_t q_orient_2[4];
+
+    dsa_sampler_get_joint(sampler_2, index, &v_pos_2[0], &q_orient_2[0]);
+
+    dsa_interpolate_frames(&v_pos_1[0], &q_orient_1[0],
+                           &v_pos_2[0], &q_orient_2[0],
+                           blend, v_pos, q_orient);
+}
+
+// Checks that all the values of a blend mask are valid blending factors.
+ITCM_CODE ARM_CODE static inline
+bool blend_mask_is_valid(const uint16_t *blend_mask, uint32_t num_joints)
+{
+    for (uint32_t i = 0; i < num_joints; i++)
+    {
+        if (blend_mask[i] > inttof32(1))
+            return false;
+    }
+
+    return true;
+}
+
+// State needed to blend several animations.
+typedef struct {
+    dsa_sampler_t sampler[DSMA_MAX_BLEND_SOURCES];
+    uint32_t weight[DSMA_MAX_BLEND_SOURCES];
+    uint32_t count;
+    uint32_t num_joints;
+} dsa_blender_t;
+
+// Prepares the samplers of all animations of a blend. Animations with a weight
+// of zero are skipped. It returns a DSMA_* code (0 for success).
+ITCM_CODE ARM_CODE static inline
+int dsa_blender_init(dsa_blender_t *blender, const DSMA_BlendSource *sources,
+                     uint32_t count)
+{
+    if ((count == 0) || (count > DSMA_MAX_BLEND_SOURCES))
+        return DSMA_INVALID_BLENDING;
+
+    uint32_t num_joints = ((const dsa_t *)sources[0].dsa_file)->num_joints;
+    uint32_t total_weight = 0;
+
+    blender->count = 0;
+    blender->num_joints = num_joints;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const dsa_t *dsa = sources[i].dsa_file;
+
+        if (!dsa_is_version_valid(dsa))
+            return DSMA_INVALID_VERSION;
+
+        if (dsa->num_joints != num_joints)
+            return DSMA_INCOMPATIBLE_ANIMATIONS;
+
+        uint32_t weight = sources[i].weight;
+        if (weight > inttof32(1))
+            return DSMA_INVALID_BLENDING;
+
+        total_weight += weight;
+    }
+
+    // The weights must add up to 1.0
+    if (total_weight != inttof32(1))
+        return DSMA_INVALID_BLENDING;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint32_t weight = sources[i].weight;
+        if (weight == 0)
+            continue;
+
+        uint32_t n = blender->count;
+
+        int ret = dsa_sampler_init(&blender->sampler[n], sources[i].dsa_file,
+                                   sources[i].frame_interp);
+        if (ret != DSMA_SUCCESS)
+            return ret;
+
+        blender->weight[n] = weight;
+        blender->count = n + 1;
+    }
+
+    return DSMA_SUCCESS;
+}
+
+// Counts the frames read by two samplers that are blended.
+ITCM_CODE ARM_CODE static inline
+void stats_count_pair(const dsa_sampler_t *sampler_1,
+                      const dsa_sampler_t *sampler_2)
+{
+    stats_count_frame(sampler_1->interp);
+    stats_count_frame(sampler_2->interp);
+    DSMA_STATS_ADD(blends, 1);
+}
+
+// Counts the frames read by all the samplers of a blender.
+ITCM_CODE ARM_CODE static inline
+void stats_count_blender(const dsa_blender_t *blender)
+{
+    for (uint32_t i = 0; i < blender->count; i++)
+        stats_count_frame(blender->sampler[i].interp);
+    DSMA_STATS_ADD(blends, 1);
+}
+
+// Reads the joint with the specified index of all animations of a blend and
+// calculates their weighted average.
+ITCM_CODE ARM_CODE static inline
+void dsa_blender_get_joint(const dsa_blender_t *blender, uint32_t index,
+                           int32_t *v_pos, int32_t *q_orient)
+{
+    dsa_sampler_get_joint(&blender->sampler[0], index, v_pos, q_orient);
+
+    uint32_t count = blender->count;
+    if (count == 1)
+        return;
+
+    int32_t weight = blender->weight[0];
+
+    v_pos[0] = (v_pos[0] * weight) >> 12;
+    v_pos[1] = (v_pos[1] * weight) >> 12;
+    v_pos[2] = (v_pos[2] * weight) >> 12;
+
+    q_orient[0] = (q_orient[0] * weight) >> 12;
+    q_orient[1] = (q_orient[1] * weight) >> 12;
+    q_orient[2] = (q_orient[2] * weight) >> 12;
+    q_orient[3] = (q_orient[3] * weight) >> 12;
+
+    for (uint32_t i = 1; i < count; i++)
+    {
+        int32_t v[3];
+        int32_t q[4];
+
+        dsa_sampler_get_joint(&blender->sampler[i], index, &v[0], &q[0]);
+
+        weight = blender->weight[i];
+
+        v_pos[0] += (v[0] * weight) >> 12;
+        v_pos[1] += (v[1] * weight) >> 12;
+        v_pos[2] += (v[2] * weight) >> 12;
+
+        q_orient[0] += (q[0] * weight) >> 12;
+        q_orient[1] += (q[1] * weight) >> 12;
+        q_orient[2] += (q[2] * weight) >> 12;
+        q_orient[3] += (q[3] * weight) >> 12;
+    }
+
+    if (dsma_interp_quality != DSMA_INTERPOLATION_FAST)
+        q_normalize(q_orient);
+}
+
+// Models split in segments
+// ------------------------
+
+// Function that calculates the final matrix of a joint of a skeleton.
+typedef void (*joint_matrix_fn)(const void *arg, uint32_t index, int32_t *m);
+
+// Reads the matrix of a joint from a sampler.
+ITCM_CODE ARM_CODE static
+void joint_matrix_from_sampler(const void *arg, uint32_t index, int32_t *m)
+{
+    dsa_sampler_get_matrix(arg, index, m);
+}
+
+// Arguments of joint_matrix_from_pair().
+typedef struct {
+    const dsa_sampler_t *sampler_1;
+    const dsa_sampler_t *sampler_2;
+    const uint16_t *blend_mask; // NULL to use the same factor for all joints
+    uint32_t blend;
+} dsa_pair_t;
+
+// Reads the matrix of a joint from a blend of two animations.
+ITCM_CODE ARM_CODE static
+void joint_matrix_from_pair(const void *arg, uint32_t index, int32_t *m)
+{
+    const dsa_pair_t *pair = arg;
+
+    uint32_t blend = pair->blend;
+    if (pair->blend_mask != NULL)
+        blend = (pair->blend_mask[index] * blend) >> 12;
+
+    int32_t v_pos[3];
+    int32_t q_orient[4];
+
+    dsa_blend_two_joints(pair->sampler_1, pair->sampler_2, index, blend,
+                         &v_pos[0], &q_orient[0]);
+
+    matrix_from_joint(v_pos, q_orient, m);
+}
+
+// Reads the matrix of a joint from a blend of several animations.
+ITCM_CODE ARM_CODE static
+void joint_matrix_from_blender(const void *arg, uint32_t index, int32_t *m)
+{
+    int32_t v_pos[3];
+    int32_t q_orient[4];
+
+    dsa_blender_get_joint(arg, index, &v_pos[0], &q_orient[0]);
+
+    matrix_from_joint(v_pos, q_orient, m);
+}
+
+// Reads the matrix of a joint from a pose.
+ITCM_CODE ARM_CODE static
+void joint_matrix_from_pose(const void *arg, uint32_t index, int32_t *m)
+{
+    const dsma_pose_t *pose = arg;
+
+    for (int i = 0; i < 12; i++)
+        m[i] = pose->matrix[index][i];
+}
+
+// Returns true if the DSM file is split in segments.
+ITCM_CODE ARM_CODE static inline
+bool dsm_is_segmented(const void *dsm_file)
+{
+    const dsm_segmented_t *dsm = dsm_file;
+    return dsm->magic == DSM_SEGMENTED_MAGIC;
+}
+
+// Draws a model split in segments. Before drawing each segment, the joints it
+// needs are loaded to the stack with the provided function. It returns a DSMA_*
+// code (0 for success).
+ITCM_CODE ARM_CODE static
+int dsm_draw_segmented(const void *dsm_file, uint32_t num_joints,
+                       joint_matrix_fn get_matrix, const void *arg)
+{
+    const dsm_segmented_t *dsm = dsm_file;
+
+    if (dsm->num_joints > num_joints)
+        return DSMA_INCOMPATIBLE_ANIMATIONS;
+
+    uint32_t segment_size = dsm->segment_size;
+    if ((segment_size == 0) || (segment_size > DSMA_MAX_JOINTS))
+        return DSMA_INVALID_MODEL;
+
+    joint_writer_t writer;
+    int ret = joint_writer_init(&writer, segment_size);
+    if (ret != DSMA_SUCCESS)
+        return ret;
+
+    // Make sure that there is enough space in the matrix stack
+    // --------------------------------------------------------
+
+    uint32_t base_matrix = 30 - segment_size + 1;
+
+    // Wait for matrix push/pop operations to end
+    gx_wait_matrix_stack();
+
+    uint32_t curr_stack_level = (GFX_STATUS >> 8) & 0x1F;
+    if (curr_stack_level >= base_matrix)
+        return DSMA_MATRIX_STACK_FULL;
+
+    MATRIX_PUSH = 0;
+
+    joint_writer_set_levels(&writer, curr_stack_level, base_matrix);
+
+    // Draw all segments
+    // -----------------
+
+    uint32_t num_segments = dsm->num_segments;
+
+    for (uint32_t i = 0; i < num_segments; i++)
+    {
+        const dsm_segment_t *segment =
+                (const dsm_segment_t *)((uintptr_t)dsm + dsm->offset[i]);
+
+        uint32_t num_loads = segment->num_loads;
+
+        for (uint32_t j = 0; j < num_loads; j++)
+        {
+            int32_t m[12];
+            get_matrix(arg, segment->load[j].joint, &m[0]);
+            joint_writer_add_matrix(&writer, segment->load[j].slot, &m[0]);
+        }
+
+        joint_writer_flush(&writer);
+
+        gx_call_list((uint32_t *)&segment->load[(num_loads + 1) & ~1]);
+    }
+
+    MATRIX_POP = 1;
+
+    return DSMA_SUCCESS;
+}
+
+// Draws a model animated by a DSA file with matrices. If the frame is an
+// integer, the command list of the frame in the file is sent to the geometry
+// engine as it is, without any CPU work. If not, the matrices of the two frames
+// are interpolated. It returns a DSMA_* code (0 for success).
+ITCM_CODE ARM_CODE static
+int dsm_draw_matrices(const void *dsm_file, const void *dsa_file,
+                      uint32_t frame_interp)
+{
+    dsa_sampler_t sampler;
+    int ret = dsa_sampler_init(&sampler, dsa_file, frame_interp);
+    if (ret != DSMA_SUCCESS)
+        return ret;
+
+    uint32_t num_joints = sampler.dsa->num_joints;
+
+    if (dsm_is_segmented(dsm_file))
+    {
+        ret = dsm_draw_segmented(dsm_file, num_joints,
+                                 joint_matrix_from_sampler, &sampler);
+        if (ret == DSMA_SUCCESS)
+            stats_count_frame(sampler.interp);
+        return ret;
+    }
+
+    if (num_joints > DSMA_MAX_JOINTS)
+        return DSMA_MATRIX_STACK_FULL;
+
+    // Make sure that there is enough space in the matrix stack
+    // --------------------------------------------------------
+
+    uint32_t base_matrix = 30 - num_joints + 1;
+    uint32_t model_matrix = base_matrix - 1;
+
+    // Wait for matrix push/pop operations to end
+    gx_wait_matrix_stack();
+
+    uint32_t curr_stack_level = (GFX_STATUS >> 8) & 0x1F;
+    if (curr_stack_level >= base_matrix)
+        return DSMA_MATRIX_STACK_FULL;
+
+    // The command lists of the file restore the matrix of the model from a
+    // fixed slot, instead of the slot of the current stack level. The stack
+    // pointer isn't modified.
+    MATRIX_STORE = model_matrix;
+
+    // Load matrices of all joints
+    // ---------------------------
+
+    if (sampler.interp == 0)
+    {
+        DSMA_STATS_ADD(joints_evaluated, num_joints);
+        gx_call_list(sampler.frame_ptr_1);
+    }
+    else
+    {
+        // The stack pointer hasn't been modified, so it's safe to return here
+        joint_writer_t writer;
+        ret = joint_writer_init(&writer, num_joints);
+        if (ret != DSMA_SUCCESS)
+            return ret;
+
+        joint_writer_set_levels(&writer, model_matrix, base_matrix);
+
+        for (uint32_t i = 0; i < num_joints; i++)
+        {
+            int32_t m[12];
+            dsa_sampler_get_matrix(&sampler, i, &m[0]);
+            joint_writer_add_matrix(&writer, i, &m[0]);
+        }
+
+        joint_writer_flush(&writer);
+    }
+
+    stats_count_frame(sampler.interp);
+
+    // Draw model
+    // ----------
+
+    gx_call_list((uint32_t *)dsm_file);
+
+    MATRIX_RESTORE = model_matrix;
+
+    return DSMA_SUCCESS;
+}
+
+// Public functions
+// ================
+
+uint32_t DSMA_GetNumFrames(const void *dsa_file)
+{
+    const dsa_t *dsa = dsa_file;
+    return dsa->num_frames;
+}
+
+uint32_t DSMA_GetNumJoints(const void *dsa_file)
+{
+    const dsa_t *dsa = dsa_file;
+    return dsa->num_joints;
+}
+
+void DSMA_SetCommandBuffer(void *buffer, size_t size)
+{
+    dsma_cmd_buffer = buffer;
+    dsma_cmd_buffer_size = size;
+}
+
+void DSMA_SetInterpolationQuality(uint32_t quality)
+{
+    dsma_interp_quality = quality;
+}
+
+#ifdef DSMA_STATS
+
+void DSMA_GetStats(DSMA_Stats *stats)
+{
+    *stats = dsma_stats;
+}
+
+void DSMA_ResetStats(void)
+{
+    dsma_stats = (DSMA_Stats){ 0 };
+}
+
+void DSMA_SetStatsClock(DSMA_StatsClockFn clock)
+{
+    dsma_stats_clock = clock;
+}
+
+#endif // DSMA_STATS
+
+uint32_t DSMA_HashName(const char *name)
+{
+    // 32-bit FNV-1a
+    uint32_t hash = 0x811C9DC5;
+
+    while (*name != '\0')
+    {
+        hash ^= (uint8_t)*name++;
+        hash *= 0x01000193;
+    }
+
+    return hash;
+}
+
+uint32_t DSMA_ContainerGetNumFiles(const void *container)
+{
+    const dsma_container_t *c = container;
+
+    if (c->magic != DSMA_CONTAINER_MAGIC)
+        return 0;
+
+    return c->num_files;
+}
+
+const void *DSMA_ContainerGetFileByHash(const void *container, uint32_t name_hash)
+{
+    const dsma_container_t *c = container;
+
+    if (c->magic != DSMA_CONTAINER_MAGIC)
+        return NULL;
+
+    // Binary search in the index
+    uint32_t low = 0;
+    uint32_t high = c->num_files;
+    while (low < high)
+    {
+        uint32_t mid = (low + high) >> 1;
+        uint32_t hash = c->entry[mid].name_hash;
+
+        if (hash == name_hash)
+            return (const void *)((uintptr_t)c + c->entry[mid].offset);
+
+        if (hash < name_hash)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    return NULL;
+}
+
+const void *DSMA_ContainerGetFile(const void *container, const char *name)
+{
+    return DSMA_ContainerGetFileByHash(container, DSMA_HashName(name));
+}
+
+int DSMA_StreamInit(DSMA_Stream *stream, void *buffer, size_t size,
+                    DSMA_StreamReadFn read, void *arg)
+{
+    if ((buffer == NULL) || (size < sizeof(dsa_compact_t)))
+        return DSMA_STREAM_BUFFER_TOO_SMALL;
+
+    // The buffer holds a copy of the header of the DSA file followed by the
+    // window of frames, so it can be used as a regular DSA file.
+
+    if (read(arg, 0, buffer, sizeof(dsa_t)) != 0)
+        return DSMA_STREAM_READ_ERROR;
+
+    const dsa_t *dsa = buffer;
+    uint32_t header_size, frame_size;
+
+    if (dsa_get_version(dsa) == DSA_VERSION_NUMBER)
+    {
+        header_size = sizeof(dsa_t);
+        frame_size = dsa->num_joints * sizeof(dsa_joint_t);
+    }
+    else if (dsa_get_version(dsa) == DSA_VERSION_COMPACT)
+    {
+        if (read(arg, 0, buffer, sizeof(dsa_compact_t)) != 0)
+            return DSMA_STREAM_READ_ERROR;
+
+        const dsa_compact_t *dsa_compact = buffer;
+        uint32_t num_static = dsa_compact->num_joints - dsa_compact->num_animated;
+        uint32_t slots_size = (dsa_compact->num_joints + 3) & ~3;
+
+        header_size = sizeof(dsa_compact_t) + slots_size
+                    + num_static * sizeof(dsa_compact_joint_t);
+        frame_size = dsa_compact->num_animated * sizeof(dsa_compact_joint_t);
+    }
+    else
+    {
+        // DSA files with tracks don't store frames in order, and the frames of
+        // DSA files with matrices don't fit in DSMA_STREAM_BUFFER_SIZE().
+        return DSMA_INVALID_VERSION;
+    }
+
+    if (header_size > size)
+        return DSMA_STREAM_BUFFER_TOO_SMALL;
+
+    // At least the current frame and the next one are needed to interpolate
+    uint32_t window = 2;
+    if (frame_size > 0)
+        window = (size - header_size) / frame_size;
+    if (window < 2)
+        return DSMA_STREAM_BUFFER_TOO_SMALL;
+
+    if (read(arg, 0, buffer, header_size) != 0)
+        return DSMA_STREAM_READ_ERROR;
+
+    stream->read = read;
+    stream->arg = arg;
+    stream->buffer = buffer;
+    stream->header_size = header_size;
+    stream->frame_size = frame_size;
+    stream->num_frames = dsa->num_frames;
+    stream->window = window;
+    stream->first_frame = 0;
+    stream->first_slot = 0;
+    stream->count = 0;
+
+    // The window of frames looks like an animation of 'window' frames
+    ((dsa_t *)buffer)->num_frames = window;
+
+    return DSMA_SUCCESS;
+}
+
+// Reads frames from the file until the window is full. Frames are read in
+// blocks of consecutive frames, so most of the time there is only one read.
+static int dsma_stream_fill(DSMA_Stream *stream)
+{
+    uint8_t *frames = (uint8_t *)stream->buffer + stream->header_size;
+
+    while (stream->count < stream->window)
+    {
+        uint32_t frame = (stream->first_frame + stream->count) % stream->num_frames;
+        uint32_t slot = (stream->first_slot + stream->count) % stream->window;
+
+        uint32_t run = stream->window - stream->count;
+        if (run > stream->num_frames - frame)
+            run = stream->num_frames - frame;
+        if (run > stream->window - slot)
+            run = stream->window - slot;
+
+        if (stream->frame_size > 0)
+        {
+            if (stream->read(stream->arg,
+                             stream->header_size + frame * stream->frame_size,
+                             frames + slot * stream->frame_size,
+                             run * stream->frame_size) != 0)
+                return DSMA_STREAM_READ_ERROR;
+        }
+
+        stream->count += run;
+    }
+
+    return DSMA_SUCCESS;
+}
+
+int DSMA_StreamSetFrame(DSMA_Stream *stream, uint32_t frame_interp,
+                        uint32_t *local_frame_interp)
+{
+    uint32_t frame = frame_interp >> 12;
+    if (frame >= stream->num_frames)
+        return DSMA_INVALID_FRAME;
+
+    // Position of the frame in the window
+    uint32_t pos = (frame + stream->num_frames - stream->first_frame)
+                 % stream->num_frames;
+
+    if (pos < stream->count)
+    {
+        // Frames before the current one aren't needed anymore
+        stream->first_frame = frame;
+        stream->first_slot = (stream->first_slot + pos) % stream->window;
+        stream->count -= pos;
+    }
+    else
+    {
+        // The frame isn't in the window, start again from this frame
+        stream->first_frame = frame;
+        stream->first_slot = 0;
+        stream->count = 0;
+    }
+
+    int ret = dsma_stream_fill(stream);
+    if (ret != DSMA_SUCCESS)
+    {
+        stream->count = 0;
+        return ret;
+    }
+
+    *local_frame_interp = (stream->first_slot << 12) | (frame_interp & 0xFFF);
+
+    return DSMA_SUCCESS;
+}
+
+const void *DSMA_StreamGetDSA(const DSMA_Stream *stream)
+{
+    return stream->buffer;
+}
+
+uint32_t DSMA_StreamGetNumFrames(const DSMA_Stream *stream)
+{
+    return stream->num_frames;
+}
+
+// Information about a geometry engine command.
+typedef struct {
+    uint8_t valid;   // 0 if the ID isn't a valid command
+    uint8_t params;  // Number of parameters
+    uint16_t cycles; // Cycles that the geometry engine needs to execute it
+} gx_cmd_info_t;
+
+// Information about all geometry engine commands, indexed by ID. The cycles are
+// taken from GBATEK, like in the table of display_list.py. NORMAL takes between
+// 9 and 12 cycles depending on the number of lights, the worst case is used.
+static const gx_cmd_info_t gx_cmd_info[] = {
+    [0x00] = { 1, 0, 0 },    // NOP
+    [0x10] = { 1, 1, 1 },    // MTX_MODE
+    [0x11] = { 1, 0, 17 },   // MTX_PUSH
+    [0x12] = { 1, 1, 36 },   // MTX_POP
+    [0x13] = { 1, 1, 17 },   // MTX_STORE
+    [0x14] = { 1, 1, 36 },   // MTX_RESTORE
+    [0x15] = { 1, 0, 19 },   // MTX_IDENTITY
+    [0x16] = { 1, 16, 34 },  // MTX_LOAD_4x4
+    [0x17] = { 1, 12, 30 },  // MTX_LOAD_4x3
+    [0x18] = { 1, 16, 35 },  // MTX_MULT_4x4
+    [0x19] = { 1, 12, 31 },  // MTX_MULT_4x3
+    [0x1A] = { 1, 9, 28 },   // MTX_MULT_3x3
+    [0x1B] = { 1, 3, 22 },   // MTX_SCALE
+    [0x1C] = { 1, 3, 22 },   // MTX_TRANS
+    [0x20] = { 1, 1, 1 },    // COLOR
+    [0x21] = { 1, 1, 12 },   // NORMAL
+    [0x22] = { 1, 1, 1 },    // TEXCOORD
+    [0x23] = { 1, 2, 9 },    // VTX_16
+    [0x24] = { 1, 1, 8 },    // VTX_10
+    [0x25] = { 1, 1, 8 },    // VTX_XY
+    [0x26] = { 1, 1, 8 },    // VTX_XZ
+    [0x27] = { 1, 1, 8 },    // VTX_YZ
+    [0x28] = { 1, 1, 8 },    // VTX_DIFF
+    [0x29] = { 1, 1, 1 },    // POLYGON_ATTR
+    [0x2A] = { 1, 1, 1 },    // TEXIMAGE_PARAM
+    [0x2B] = { 1, 1, 1 },    // PLTT_BASE
+    [0x30] = { 1, 1, 4 },    // DIF_AMB
+    [0x31] = { 1, 1, 4 },    // SPE_EMI
+    [0x32] = { 1, 1, 6 },    // LIGHT_VECTOR
+    [0x33] = { 1, 1, 1 },    // LIGHT_COLOR
+    [0x34] = { 1, 32, 32 },  // SHININESS
+    [0x40] = { 1, 1, 1 },    // BEGIN_VTXS
+    [0x41] = { 1, 0, 1 },    // END_VTXS
+    [0x50] = { 1, 1, 392 },  // SWAP_BUFFERS
+    [0x60] = { 1, 1, 1 },    // VIEWPORT
+    [0x70] = { 1, 3, 103 },  // BOX_TEST
+    [0x71] = { 1, 2, 9 },    // POS_TEST
+    [0x72] = { 1, 1, 5 },    // VEC_TEST
+};
+
+// Returns the number of polygons drawn by a list of vertices started by a
+// BEGIN_VTXS command with the specified type.
+static uint32_t gx_polygons_in_list(uint32_t poly_type, uint32_t num_vertices)
+{
+    if (poly_type == GL_TRIANGLES)
+        return num_vertices / 3;
+    if (poly_type == GL_QUADS)
+        return num_vertices / 4;
+    if (num_vertices < 3)
+        return 0;
+    if (poly_type == GL_TRIANGLE_STRIP)
+        return num_vertices - 2;
+    return (num_vertices - 2) / 2;
+}
+
+// Adds the statistics of a display list to the ones in 'stats'. It returns a
+// DSMA_* code (0 for success).
+static int dsm_display_list_stats(const uint32_t *list, DSMA_ModelStats *stats)
+{
+    uint32_t size = *list++;
+    const uint32_t *end = list + size;
+
+    bool in_list = false;
+    uint32_t poly_type = 0;
+    uint32_t list_vertices = 0;
+
+    stats->num_words += size;
+
+    while (list < end)
+    {
+        uint32_t header = *list++;
+
+        for (uint32_t i = 0; i < 4; i++)
+        {
+            uint32_t id = (header >> (i * 8)) & 0xFF;
+
+            if ((id >= sizeof(gx_cmd_info) / sizeof(gx_cmd_info[0])) ||
+                !gx_cmd_info[id].valid)
+                return DSMA_INVALID_MODEL;
+
+            stats->num_cycles += gx_cmd_info[id].cycles;
+
+            if ((id >= GX_CMD_VTX_16) && (id <= GX_CMD_VTX_DIFF))
+            {
+                stats->num_vertices++;
+                list_vertices++;
+            }
+            else if ((id == GX_CMD_BEGIN_VTXS) || (id == GX_CMD_END_VTXS))
+            {
+                if (in_list)
+                    stats->num_polygons += gx_polygons_in_list(poly_type, list_vertices);
+
+                in_list = (id == GX_CMD_BEGIN_VTXS);
+                poly_type = *list & 3;
+                list_vertices = 0;
+            }
+
+            list += gx_cmd_info[id].params;
+        }
+    }
+
+    // Lists that aren't closed with END_VTXS are still drawn
+    if (in_list)
+        stats->num_polygons += gx_polygons_in_list(poly_type, list_vertices);
+
+    if (list != end)
+        return DSMA_INVALID_MODEL;
+
+    return DSMA_SUCCESS;
+}
+
+int DSMA_GetModelStats(const void *dsm_file, DSMA_ModelStats *stats)
+{
+    *stats = (DSMA_ModelStats){ 0 };
+
+    if (dsm_is_segmented(dsm_file))
+    {
+        const dsm_segmented_t *dsm = dsm_file;
+
+        for (uint32_t i = 0; i < dsm->num_segments; i++)
+        {
+            const dsm_segment_t *segment =
+                    (const dsm_segment_t *)((uintptr_t)dsm + dsm->offset[i]);
+            const uint32_t *list =
+                    (const uint32_t *)&segment->load[(segment->num_loads + 1) & ~1];
+
+            int ret = dsm_display_list_stats(list, stats);
+            if (ret != DSMA_SUCCESS)
+                return ret;
+        }
+    }
+    else if (((const dsm_baked_t *)dsm_file)->magic == DSM_BAKED_MAGIC)
+    {
+        const dsm_baked_t *dsm = dsm_file;
+
+        // Only one frame is drawn at a time, return the slowest one
+        for (uint32_t i = 0; i < dsm->num_frames; i++)
+        {
+            DSMA_ModelStats frame_stats = { 0 };
+
+            int ret = dsm_display_list_stats(
+                    (const uint32_t *)((uintptr_t)dsm + dsm->offset[i]),
+                    &frame_stats);
+            if (ret != DSMA_SUCCESS)
+                return ret;
+
+            if (frame_stats.num_cycles > stats->num_cycles)
+                *stats = frame_stats;
+        }
+    }
+    else
+    {
+        return dsm_display_list_stats(dsm_file, stats);
+    }
+
+    return DSMA_SUCCESS;
+}
+
+int DSMA_TestBounds(const void *bounds_file, uint32_t frame_interp)
+{
+    const dsa_bounds_t *bounds = bounds_file;
+
+    if (bounds->magic != DSA_BOUNDS_MAGIC)
+        return DSMA_INVALID_VERSION;
+
+    uint32_t frame = frame_interp >> 12;
+    if (frame >= bounds->num_frames)
+        return DSMA_INVALID_FRAME;
+
+    // Scaling the matrix up and down by a power of two is exact, so there is no
+    // need to save it in the stack. This is only true if the scale factor used
+    // to restore the matrix isn't truncated, so the shift can't be greater than
+    // the number of fractional bits.
+    uint32_t shift = bounds->pos_shift;
+    if (shift > DSA_BOUNDS_MAX_SHIFT)
+        return DSMA_INVALID_VERSION;
+
+    if (shift > 0)
+    {
+        MATRIX_SCALE = inttof32(1) << shift;
+        MATRIX_SCALE = inttof32(1) << shift;
+        MATRIX_SCALE = inttof32(1) << shift;
+    }
+
+    const uint32_t *box = &bounds->box[frame][0];
+    GFX_BOX_TEST = box[0];
+    GFX_BOX_TEST = box[1];
+    GFX_BOX_TEST = box[2];
+
+    if (shift > 0)
+    {
+        MATRIX_SCALE = inttof32(1) >> shift;
+        MATRIX_SCALE = inttof32(1) >> shift;
+        MATRIX_SCALE = inttof32(1) >> shift;
+    }
+
+    // Wait for the result of the test
+    while (GFX_STATUS & BIT(0));
+
+    return (GFX_STATUS & BIT(1)) ? 1 : 0;
+}
+
+uint32_t DSMA_SelectLOD(const DSMA_LOD *lods, uint32_t num_lods, int32_t size,
+                        uint32_t max_polygons)
+{
+    for (uint32_t i = 0; i < num_lods; i++)
+    {
+        if ((size >= lods[i].min_size) && (lods[i].num_polygons <= max_polygons))
+            return i;
+    }
+
+    return num_lods;
+}
+
+ITCM_CODE ARM_CODE
+int DSMA_DrawModel(const void *dsm_file, const void *dsa_file, uint32_t frame_interp)
+{
+    const dsa_t *dsa = dsa_file;
+
+    if (dsa_get_version(dsa) == DSA_VERSION_MATRICES)
+        return dsm_draw_matrices(dsm_file, dsa_file, frame_interp);
+
+    if (!dsa_is_version_valid(dsa))
+        return DSMA_INVALID_VERSION;
+
+    frame_interp = dsa_snap_frame(dsa, frame_interp);
+
+    uint32_t num_joints = dsa->num_joints;
+    uint32_t num_frames = dsa->num_frames;
+
+    uint32_t frame = frame_interp >> 12;
+    uint32_t interp = frame_interp & 0xFFF;
+
+    if (frame >= num_frames)
+        return DSMA_INVALID_FRAME;
+
+    if (dsm_is_segmented(dsm_file))
+    {
+        dsa_sampler_t sampler;
+        int ret = dsa_sampler_init(&sampler, dsa_file, frame_interp);
+        if (ret != DSMA_SUCCESS)
+            return ret;
+
+        ret = dsm_draw_segmented(dsm_file, num_joints,
+                                 joint_matrix_from_sampler, &sampler);
+        if (ret == DSMA_SUCCESS)
+            stats_count_frame(interp);
+        return ret;
+    }
+
+    if (num_joints > DSMA_MAX_JOINTS)
+        return DSMA_MATRIX_STACK_FULL;
+
+    joint_writer_t writer;
+    int ret = joint_writer_init(&writer, num_joints);
+    if (ret != DSMA_SUCCESS)
+        return ret;
+
+    // Make sure that there is enough space in the matrix stack
+    // --------------------------------------------------------
+
+    uint32_t base_matrix = 30 - num_joints + 1;
+
+    // Wait for matrix push/pop operations to end
+    gx_wait_matrix_stack();
+
+    uint32_t curr_stack_level = (GFX_STATUS >> 8) & 0x1F;
+    if (curr_stack_level >= base_matrix)
+        return DSMA_MATRIX_STACK_FULL;
+
+    stats_count_frame(interp);
+
+    MATRIX_PUSH = 0;
+
+    joint_writer_set_levels(&writer, curr_stack_level, base_matrix);
+
+    // Generate matrices with bone transformations
+    // -------------------------------------------
+
+    if (dsa_get_version(dsa) == DSA_VERSION_TRACKS)
+    {
+        const dsa_tracks_t *dsa_tracks = dsa_file;
+
+        for (uint32_t i = 0; i < num_joints; i++)
+        {
+            int32_t v_pos[3];
+            int32_t q_orient[4];
+
+            dsa_track_sample(dsa_tracks, i, frame_interp, &v_pos[0], &q_orient[0]);
+
+            joint_writer_add_joint(&writer, i, v_pos, q_orient);
+        }
+    }
+    else if (dsa_get_version(dsa) == DSA_VERSION_COMPACT)
+    {
+        const dsa_compact_t *dsa_compact = dsa_file;
+        uint32_t pos_shift = dsa_compact->pos_shift;
+        uint32_t num_animated = dsa_compact->num_animated;
+        const uint8_t *joint_slot = &dsa_compact->joint_slot[0];
+        const dsa_compact_joint_t *static_joints =
+                dsa_compact_get_static_joints(dsa_compact);
+
+        uint32_t next_frame = frame + 1;
+        if (next_frame == num_frames)
+            next_frame = 0;
+
+        const dsa_compact_joint_t *frame_ptr_1 =
+                dsa_compact_get_frame(dsa_compact, frame);
+        const dsa_compact_joint_t *frame_ptr_2 =
+                dsa_compact_get_frame(dsa_compact, next_frame);
+
+        for (uint32_t i = 0; i < num_joints; i++)
+        {
+            int32_t v_pos[3];
+            int32_t q_orient[4];
+
+            uint32_t slot = joint_slot[i];
+
+            if (slot >= num_animated)
+            {
+                // Static joints don't need to be interpolated
+                dsa_compact_unpack_joint(&static_joints[slot - num_animated],
+                                         pos_shift, &v_pos[0], &q_orient[0]);
+            }
+            else if (interp != 0)
+            {
+                int32_t v_pos_1[3], v_pos_2[3];
+                int32_t q_orient_1[4], q_orient_2[4];
+
+                dsa_compact_unpack_joint(&frame_ptr_1[slot], pos_shift,
+                                         &v_pos_1[0], &q_orient_1[0]);
+                dsa_compact_unpack_joint(&frame_ptr_2[slot], pos_shift,
+                                         &v_pos_2[0], &q_orient_2[0]);
+
+                dsa_interpolate_frames(&v_pos_1[0], &q_orient_1[0],
+                                       &v_pos_2[0], &q_orient_2[0],
+                                       interp, &v_pos[0], &q_orient[0]);
+            }
+            else
+            {
+                dsa_compact_unpack_joint(&frame_ptr_1[slot], pos_shift,
+                                         &v_pos[0], &q_orient[0]);
+            }
+
+            joint_writer_add_joint(&writer, i, v_pos, q_orient);
+        }
+    }
+    else if (interp != 0)
+    {
+        uint32_t next_frame = frame + 1;
+        if (next_frame == num_frames)
+            next_frame = 0;
+
+        const dsa_joint_t *frame_ptr_1 = dsa_get_frame(dsa, frame);
+        const dsa_joint_t *frame_ptr_2 = dsa_get_frame(dsa, next_frame);
+
+        for (uint32_t i = 0; i < num_joints; i++)
+        {
+            int32_t v_pos[3];
+            int32_t q_orient[4];
+
+            dsa_interpolate_frames(&frame_ptr_1->pos[0],
+                                   &frame_ptr_1->orient[0],
+                                   &frame_ptr_2->pos[0],
+                                   &frame_ptr_2->orient[0],
+                                   interp, &v_pos[0], &q_orient[0]);
+            frame_ptr_1++;
+            frame_ptr_2++;
+
+            joint_writer_add_joint(&writer, i, v_pos, q_orient);
+        }
+    }
+    else
+    {
+        const dsa_joint_t *frame_ptr = dsa_get_frame(dsa, frame);
+
+        for (uint32_t i = 0; i < num_joints; i++)
+        {
+            // Get transformation
+            const int32_t *v_pos = frame_ptr->pos;
+            const int32_t *q_orient = frame_ptr->orient;
+            frame_ptr++;
+
+            joint_writer_add_joint(&writer, i, v_pos, q_orient);
+        }
+    }
+
+    joint_writer_flush(&writer);
+
+    // Draw model
+    // ----------
+
+    gx_call_list((uint32_t *)dsm_file);
+
+    MATRIX_POP = 1;
+
+    return DSMA_SUCCESS;
+}
+
+ITCM_CODE ARM_CODE
+int DSMA_DrawModelBlendAnimation(const void *dsm_file,
+        const void *dsa_file_1, uint32_t frame_interp_1,
+        const void *dsa_file_2, uint32_t frame_interp_2,
+        uint32_t blend)
+{
+    const dsa_t *dsa_1 = dsa_file_1;
+    const dsa_t *dsa_2 = dsa_file_2;
+
+    if (!dsa_is_version_valid(dsa_1))
+        return DSMA_INVALID_VERSION;
+
+    if (!dsa_is_version_valid(dsa_2))
+        return DSMA_INVALID_VERSION;
+
+    uint32_t num_joints = dsa_1->num_joints;
+
+    if (num_joints != dsa_2->num_joints)
+        return DSMA_INCOMPATIBLE_ANIMATIONS;
+
+    if (blend > inttof32(1))
+        return DSMA_INVALID_BLENDING;
+
+    dsa_sampler_t sampler_1;
+    int ret = dsa_sampler_init(&sampler_1, dsa_file_1, frame_interp_1);
+    if (ret != DSMA_SUCCESS)
+        return ret;
+
+    dsa_sampler_t sampler_2;
+    ret = dsa_sampler_init(&sampler_2, dsa_file_2, frame_interp_2);
+    if (ret != DSMA_SUCCESS)
+        return ret;
+
+    if (dsm_is_segmented(dsm_file))
+    {
+        dsa_pair_t pair = { &sampler_1, &sampler_2, NULL, blend };
+        ret = dsm_draw_segmented(dsm_file, num_joints,
+                                 joint_matrix_from_pair, &pair);
+        if (ret == DSMA_SUCCESS)
+            stats_count_pair(&sampler_1, &sampler_2);
+        return ret;
+    }
+
+    if (num_joints > DSMA_MAX_JOINTS)
+        return DSMA_MATRIX_STACK_FULL;
+
+    joint_writer_t writer;
+    ret = joint_writer_init(&writer, num_joints);
+    if (ret != DSMA_SUCCESS)
+        return ret;
+
+    // Make sure that there is enough space in the matrix stack
+    // --------------------------------------------------------
+
+    uint32_t base_matrix = 30 - num_joints + 1;
+
+    // Wait for matrix push/pop operations to end
+    gx_wait_matrix_stack();
+
+    uint32_t curr_stack_level = (GFX_STATUS >> 8) & 0x1F;
+    if (curr_stack_level >= base_matrix)
+        return DSMA_MATRIX_STACK_FULL;
+
+    stats_count_pair(&sampler_1, &sampler_2);
+
+    MATRIX_PUSH = 0;
+
+    joint_writer_set_levels(&writer, curr_stack_level, base_matrix);
+
+    // Generate matrices with bone transformations
+    // -------------------------------------------
+
+    for (uint32_t i = 0; i < num_joints; i++)
+    {
+        int32_t v_pos[3];
+        int32_t q_orient[4];
+
+        dsa_blend_two_joints(&sampler_1, &sampler_2, i, blend,
+                             &v_pos[0], &q_orient[0]);
+
+        joint_writer_add_joint(&writer, i, v_pos, q_orient);
+    }
+
+    joint_writer_flush(&writer);
+
+    // Draw model
+    // ----------
+
+    gx_call_list((uint32_t *)dsm_file);
+
+    MATRIX_POP = 1;
+
+    return DSMA_SUCCESS;
+}
+
+ITCM_CODE ARM_CODE
+int DSMA_DrawModelBlendAnimationMask(const void *dsm_file,
+        const void *dsa_file_1, uint32_t frame_interp_1,
+        const void *dsa_file_2, uint32_t frame_interp_2,
+        const uint16_t *blend_mask, uint32_t blend)
+{
+    const dsa_t *dsa_1 = dsa_file_1;
+    const dsa_t *dsa_2 = dsa_file_2;
+
+    if (!dsa_is_version_valid(dsa_1))
+        return DSMA_INVALID_VERSION;
+
+    if (!dsa_is_version_valid(dsa_2))
+        return DSMA_INVALID_VERSION;
+
+    uint32_t num_joints = dsa_1->num_joints;
 
-            // Store it in the right position in the stack
-            MATRIX_STORE = base_matrix + i;
-        }
+    if (num_joints != dsa_2->num_joints)
+        return DSMA_INCOMPATIBLE_ANIMATIONS;
+
+    if (blend > inttof32(1))
+        return DSMA_INVALID_BLENDING;
+
+    if (!blend_mask_is_valid(blend_mask, num_joints))
+        return DSMA_INVALID_BLENDING;
+
+    dsa_sampler_t sampler_1;
+    int ret = dsa_sampler_init(&sampler_1, dsa_file_1, frame_interp_1);
+    if (ret != DSMA_SUCCESS)
+        return ret;
+
+    dsa_sampler_t sampler_2;
+    ret = dsa_sampler_init(&sampler_2, dsa_file_2, frame_interp_2);
+    if (ret != DSMA_SUCCESS)
+        return ret;
+
+    if (dsm_is_segmented(dsm_file))
+    {
+        dsa_pair_t pair = { &sampler_1, &sampler_2, blend_mask, blend };
+        ret = dsm_draw_segmented(dsm_file, num_joints,
+                                 joint_matrix_from_pair, &pair);
+        if (ret == DSMA_SUCCESS)
+            stats_count_pair(&sampler_1, &sampler_2);
+        return ret;
     }
-    else
+
+    if (num_joints > DSMA_MAX_JOINTS)
+        return DSMA_MATRIX_STACK_FULL;
+
+    joint_writer_t writer;
+    ret = joint_writer_init(&writer, num_joints);
+    if (ret != DSMA_SUCCESS)
+        return ret;
+
+    // Make sure that there is enough space in the matrix stack
+    // --------------------------------------------------------
+
+    uint32_t base_matrix = 30 - num_joints + 1;
+
+    // Wait for matrix push/pop operations to end
+    gx_wait_matrix_stack();
+
+    uint32_t curr_stack_level = (GFX_STATUS >> 8) & 0x1F;
+    if (curr_stack_level >= base_matrix)
+        return DSMA_MATRIX_STACK_FULL;
+
+    stats_count_pair(&sampler_1, &sampler_2);
+
+    MATRIX_PUSH = 0;
+
+    joint_writer_set_levels(&writer, curr_stack_level, base_matrix);
+
+    // Generate matrices with bone transformations
+    // -------------------------------------------
+
+    for (uint32_t i = 0; i < num_joints; i++)
     {
-        const dsa_joint_t *frame_ptr = dsa_get_frame(dsa, frame);
+        int32_t v_pos[3];
+        int32_t q_orient[4];
 
-        for (uint32_t i = 0; i < num_joints; i++)
-        {
-            // Get transformation
-            const int32_t *v_pos = frame_ptr->pos;
-            const int32_t *q_orient = frame_ptr->orient;
-            frame_ptr++;
+        uint32_t joint_blend = (blend_mask[i] * blend) >> 12;
 
-            // Generate new matrix
-            MATRIX_RESTORE = curr_stack_level;
-            matrix_mult_by_joint(v_pos, q_orient);
+        dsa_blend_two_joints(&sampler_1, &sampler_2, i, joint_blend,
+                             &v_pos[0], &q_orient[0]);
 
-            // Store it in the right position in the stack
-            MATRIX_STORE = base_matrix + i;
-        }
+        joint_writer_add_joint(&writer, i, v_pos, q_orient);
     }
 
+    joint_writer_flush(&writer);
+
     // Draw model
     // ----------
 
-    glCallList((uint32_t *)dsm_file);
+    gx_call_list((uint32_t *)dsm_file);
 
     MATRIX_POP = 1;
 
@@ -218,18 +2172,113 @@ int DSMA_DrawModel(const void *dsm_file, const void *dsa_file, uint32_t frame_in
 }
 
 ITCM_CODE ARM_CODE
-int DSMA_DrawModelBlendAnimation(const void *dsm_file,
+int DSMA_DrawModelBlendMultiple(const void *dsm_file,
+                                const DSMA_BlendSource *sources, uint32_t count)
+{
+    dsa_blender_t blender;
+    int ret = dsa_blender_init(&blender, sources, count);
+    if (ret != DSMA_SUCCESS)
+        return ret;
+
+    uint32_t num_joints = blender.num_joints;
+
+    if (dsm_is_segmented(dsm_file))
+    {
+        ret = dsm_draw_segmented(dsm_file, num_joints,
+                                 joint_matrix_from_blender, &blender);
+        if (ret == DSMA_SUCCESS)
+            stats_count_blender(&blender);
+        return ret;
+    }
+
+    if (num_joints > DSMA_MAX_JOINTS)
+        return DSMA_MATRIX_STACK_FULL;
+
+    joint_writer_t writer;
+    ret = joint_writer_init(&writer, num_joints);
+    if (ret != DSMA_SUCCESS)
+        return ret;
+
+    // Make sure that there is enough space in the matrix stack
+    // --------------------------------------------------------
+
+    uint32_t base_matrix = 30 - num_joints + 1;
+
+    // Wait for matrix push/pop operations to end
+    gx_wait_matrix_stack();
+
+    uint32_t curr_stack_level = (GFX_STATUS >> 8) & 0x1F;
+    if (curr_stack_level >= base_matrix)
+        return DSMA_MATRIX_STACK_FULL;
+
+    stats_count_blender(&blender);
+
+    MATRIX_PUSH = 0;
+
+    joint_writer_set_levels(&writer, curr_stack_level, base_matrix);
+
+    // Generate matrices with bone transformations
+    // -------------------------------------------
+
+    for (uint32_t i = 0; i < num_joints; i++)
+    {
+        int32_t v_pos[3];
+        int32_t q_orient[4];
+
+        dsa_blender_get_joint(&blender, i, &v_pos[0], &q_orient[0]);
+
+        joint_writer_add_joint(&writer, i, v_pos, q_orient);
+    }
+
+    joint_writer_flush(&writer);
+
+    // Draw model
+    // ----------
+
+    gx_call_list((uint32_t *)dsm_file);
+
+    MATRIX_POP = 1;
+
+    return DSMA_SUCCESS;
+}
+
+ITCM_CODE ARM_CODE
+int DSMA_ComputePose(void *pose, const void *dsa_file, uint32_t frame_interp)
+{
+    dsma_pose_t *dest = pose;
+
+    dsa_sampler_t sampler;
+    int ret = dsa_sampler_init(&sampler, dsa_file, frame_interp);
+    if (ret != DSMA_SUCCESS)
+        return ret;
+
+    stats_count_frame(sampler.interp);
+
+    uint32_t num_joints = sampler.dsa->num_joints;
+
+    dest->num_joints = num_joints;
+
+    for (uint32_t i = 0; i < num_joints; i++)
+        dsa_sampler_get_matrix(&sampler, i, &dest->matrix[i][0]);
+
+    return DSMA_SUCCESS;
+}
+
+ITCM_CODE ARM_CODE
+int DSMA_ComputePoseBlendAnimation(void *pose,
         const void *dsa_file_1, uint32_t frame_interp_1,
         const void *dsa_file_2, uint32_t frame_interp_2,
         uint32_t blend)
 {
+    dsma_pose_t *dest = pose;
+
     const dsa_t *dsa_1 = dsa_file_1;
     const dsa_t *dsa_2 = dsa_file_2;
 
-    if (dsa_1->version != DSA_VERSION_NUMBER)
+    if (!dsa_is_version_valid(dsa_1))
         return DSMA_INVALID_VERSION;
 
-    if (dsa_2->version != DSA_VERSION_NUMBER)
+    if (!dsa_is_version_valid(dsa_2))
         return DSMA_INVALID_VERSION;
 
     uint32_t num_joints = dsa_1->num_joints;
@@ -237,31 +2286,153 @@ int DSMA_DrawModelBlendAnimation(const void *dsm_file,
     if (num_joints != dsa_2->num_joints)
         return DSMA_INCOMPATIBLE_ANIMATIONS;
 
-    uint32_t num_frames_1 = dsa_1->num_frames;
-    uint32_t num_frames_2 = dsa_2->num_frames;
+    if (blend > inttof32(1))
+        return DSMA_INVALID_BLENDING;
 
-    uint32_t frame_1 = frame_interp_1 >> 12;
-    uint32_t interp_1 = frame_interp_1 & 0xFFF;
+    dsa_sampler_t sampler_1;
+    int ret = dsa_sampler_init(&sampler_1, dsa_file_1, frame_interp_1);
+    if (ret != DSMA_SUCCESS)
+        return ret;
 
-    if (frame_1 >= num_frames_1)
-        return DSMA_INVALID_FRAME;
+    dsa_sampler_t sampler_2;
+    ret = dsa_sampler_init(&sampler_2, dsa_file_2, frame_interp_2);
+    if (ret != DSMA_SUCCESS)
+        return ret;
 
-    uint32_t frame_2 = frame_interp_2 >> 12;
-    uint32_t interp_2 = frame_interp_2 & 0xFFF;
+    stats_count_pair(&sampler_1, &sampler_2);
 
-    if (frame_2 >= num_frames_2)
-        return DSMA_INVALID_FRAME;
+    dest->num_joints = num_joints;
+
+    for (uint32_t i = 0; i < num_joints; i++)
+    {
+        int32_t v_pos[3];
+        int32_t q_orient[4];
+
+        dsa_blend_two_joints(&sampler_1, &sampler_2, i, blend,
+                             &v_pos[0], &q_orient[0]);
+
+        matrix_from_joint(v_pos, q_orient, &dest->matrix[i][0]);
+    }
+
+    return DSMA_SUCCESS;
+}
+
+ITCM_CODE ARM_CODE
+int DSMA_ComputePoseBlendAnimationMask(void *pose,
+        const void *dsa_file_1, uint32_t frame_interp_1,
+        const void *dsa_file_2, uint32_t frame_interp_2,
+        const uint16_t *blend_mask, uint32_t blend)
+{
+    dsma_pose_t *dest = pose;
+
+    const dsa_t *dsa_1 = dsa_file_1;
+    const dsa_t *dsa_2 = dsa_file_2;
+
+    if (!dsa_is_version_valid(dsa_1))
+        return DSMA_INVALID_VERSION;
+
+    if (!dsa_is_version_valid(dsa_2))
+        return DSMA_INVALID_VERSION;
+
+    uint32_t num_joints = dsa_1->num_joints;
+
+    if (num_joints != dsa_2->num_joints)
+        return DSMA_INCOMPATIBLE_ANIMATIONS;
 
     if (blend > inttof32(1))
         return DSMA_INVALID_BLENDING;
 
+    if (!blend_mask_is_valid(blend_mask, num_joints))
+        return DSMA_INVALID_BLENDING;
+
+    dsa_sampler_t sampler_1;
+    int ret = dsa_sampler_init(&sampler_1, dsa_file_1, frame_interp_1);
+    if (ret != DSMA_SUCCESS)
+        return ret;
+
+    dsa_sampler_t sampler_2;
+    ret = dsa_sampler_init(&sampler_2, dsa_file_2, frame_interp_2);
+    if (ret != DSMA_SUCCESS)
+        return ret;
+
+    stats_count_pair(&sampler_1, &sampler_2);
+
+    dest->num_joints = num_joints;
+
+    for (uint32_t i = 0; i < num_joints; i++)
+    {
+        int32_t v_pos[3];
+        int32_t q_orient[4];
+
+        uint32_t joint_blend = (blend_mask[i] * blend) >> 12;
+
+        dsa_blend_two_joints(&sampler_1, &sampler_2, i, joint_blend,
+                             &v_pos[0], &q_orient[0]);
+
+        matrix_from_joint(v_pos, q_orient, &dest->matrix[i][0]);
+    }
+
+    return DSMA_SUCCESS;
+}
+
+ITCM_CODE ARM_CODE
+int DSMA_ComputePoseBlendMultiple(void *pose, const DSMA_BlendSource *sources,
+                                  uint32_t count)
+{
+    dsma_pose_t *dest = pose;
+
+    dsa_blender_t blender;
+    int ret = dsa_blender_init(&blender, sources, count);
+    if (ret != DSMA_SUCCESS)
+        return ret;
+
+    stats_count_blender(&blender);
+
+    uint32_t num_joints = blender.num_joints;
+
+    dest->num_joints = num_joints;
+
+    for (uint32_t i = 0; i < num_joints; i++)
+    {
+        int32_t v_pos[3];
+        int32_t q_orient[4];
+
+        dsa_blender_get_joint(&blender, i, &v_pos[0], &q_orient[0]);
+
+        matrix_from_joint(v_pos, q_orient, &dest->matrix[i][0]);
+    }
+
+    return DSMA_SUCCESS;
+}
+
+ITCM_CODE ARM_CODE
+int DSMA_DrawModelPose(const void *dsm_file, const void *pose)
+{
+    const dsma_pose_t *src = pose;
+
+    uint32_t num_joints = src->num_joints;
+
+    if (dsm_is_segmented(dsm_file))
+    {
+        return dsm_draw_segmented(dsm_file, num_joints,
+                                  joint_matrix_from_pose, src);
+    }
+
+    if (num_joints > DSMA_MAX_JOINTS)
+        return DSMA_MATRIX_STACK_FULL;
+
+    joint_writer_t writer;
+    int ret = joint_writer_init(&writer, num_joints);
+    if (ret != DSMA_SUCCESS)
+        return ret;
+
     // Make sure that there is enough space in the matrix stack
     // --------------------------------------------------------
 
     uint32_t base_matrix = 30 - num_joints + 1;
 
     // Wait for matrix push/pop operations to end
-    while (GFX_STATUS & BIT(14));
+    gx_wait_matrix_stack();
 
     uint32_t curr_stack_level = (GFX_STATUS >> 8) & 0x1F;
     if (curr_stack_level >= base_matrix)
@@ -269,68 +2440,173 @@ int DSMA_DrawModelBlendAnimation(const void *dsm_file,
 
     MATRIX_PUSH = 0;
 
-    // Generate matrices with bone transformations
-    // -------------------------------------------
+    joint_writer_set_levels(&writer, curr_stack_level, base_matrix);
+
+    // Load the matrices of the pose
+    // -----------------------------
+
+    for (uint32_t i = 0; i < num_joints; i++)
+    {
+        joint_writer_add_matrix(&writer, i, &src->matrix[i][0]);
+    }
 
-    uint32_t next_frame_1 = frame_1 + 1;
-    if (next_frame_1 == num_frames_1)
-        next_frame_1 = 0;
+    joint_writer_flush(&writer);
 
-    uint32_t next_frame_2 = frame_2 + 1;
-    if (next_frame_2 == num_frames_2)
-        next_frame_2 = 0;
+    // Draw model
+    // ----------
 
-    const dsa_joint_t *frame_1_ptr_1 = dsa_get_frame(dsa_1, frame_1);
-    const dsa_joint_t *frame_1_ptr_2 = dsa_get_frame(dsa_1, next_frame_1);
+    gx_call_list((uint32_t *)dsm_file);
 
-    const dsa_joint_t *frame_2_ptr_1 = dsa_get_frame(dsa_2, frame_2);
-    const dsa_joint_t *frame_2_ptr_2 = dsa_get_frame(dsa_2, next_frame_2);
+    MATRIX_POP = 1;
 
-    for (uint32_t i = 0; i < num_joints; i++)
-    {
-        int32_t v_pos_1[3];
-        int32_t q_orient_1[4];
+    return DSMA_SUCCESS;
+}
 
-        dsa_interpolate_frames(&frame_1_ptr_1->pos[0],
-                               &frame_1_ptr_1->orient[0],
-                               &frame_1_ptr_2->pos[0],
-                               &frame_1_ptr_2->orient[0],
-                               interp_1, &v_pos_1[0], &q_orient_1[0]);
-        frame_1_ptr_1++;
-        frame_1_ptr_2++;
+ITCM_CODE ARM_CODE
+int DSMA_DrawModelInstances(const void *dsm_file, const void *dsa_file,
+                            const DSMA_Instance *instances, uint32_t count,
+                            uint32_t quantization_bits)
+{
+    const dsa_t *dsa = dsa_file;
 
-        int32_t v_pos_2[3];
-        int32_t q_orient_2[4];
+    if (!dsa_is_version_valid(dsa))
+        return DSMA_INVALID_VERSION;
 
-        dsa_interpolate_frames(&frame_2_ptr_1->pos[0],
-                               &frame_2_ptr_1->orient[0],
-                               &frame_2_ptr_2->pos[0],
-                               &frame_2_ptr_2->orient[0],
-                               interp_2, &v_pos_2[0], &q_orient_2[0]);
-        frame_2_ptr_1++;
-        frame_2_ptr_2++;
+    uint32_t num_joints = dsa->num_joints;
+    uint32_t num_frames = dsa->num_frames;
 
-        int32_t v_pos[3];
-        int32_t q_orient[4];
+    if (dsm_is_segmented(dsm_file))
+        return DSMA_INVALID_MODEL;
 
-        dsa_interpolate_frames(&v_pos_1[0], &q_orient_1[0],
-                               &v_pos_2[0], &q_orient_2[0],
-                               blend, &v_pos[0], &q_orient[0]);
+    if (num_joints > DSMA_MAX_JOINTS)
+        return DSMA_MATRIX_STACK_FULL;
 
-        // Generate new matrix
-        MATRIX_RESTORE = curr_stack_level;
-        matrix_mult_by_joint(v_pos, q_orient);
+    // Clearing more than the fractional part would merge different frames
+    if (quantization_bits > 12)
+        quantization_bits = 12;
 
-        // Store it in the right position in the stack
-        MATRIX_STORE = base_matrix + i;
+    uint32_t frame_mask = ~((1u << quantization_bits) - 1);
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if ((instances[i].frame_interp >> 12) >= num_frames)
+            return DSMA_INVALID_FRAME;
     }
 
-    // Draw model
-    // ----------
+    joint_writer_t writer;
+    int ret = joint_writer_init(&writer, num_joints);
+    if (ret != DSMA_SUCCESS)
+        return ret;
+
+    // Make sure that there is enough space in the matrix stack
+    // --------------------------------------------------------
+
+    uint32_t base_matrix = 30 - num_joints + 1;
+
+    // Wait for matrix push/pop operations to end
+    gx_wait_matrix_stack();
+
+    // The stack needs space for the current matrix and for the matrix of each
+    // instance.
+    uint32_t curr_stack_level = (GFX_STATUS >> 8) & 0x1F;
+    uint32_t instance_level = curr_stack_level + 1;
+    if (instance_level >= base_matrix)
+        return DSMA_MATRIX_STACK_FULL;
+
+    MATRIX_PUSH = 0;
+
+    joint_writer_set_levels(&writer, instance_level, base_matrix);
+
+    // Draw all instances, grouped by frame
+    // ------------------------------------
+
+    uint32_t pose_buffer[DSMA_POSE_SIZE(DSMA_MAX_JOINTS) / sizeof(uint32_t)];
+    const dsma_pose_t *pose = (const dsma_pose_t *)&pose_buffer[0];
+
+    // The instances are handled in batches so that the quantized frame of each
+    // instance can be calculated once and kept in the stack. Frames of
+    // instances that have already been drawn are replaced by an invalid frame.
+    uint32_t frames[DSMA_INSTANCES_PER_BATCH];
+    const uint32_t drawn = UINT32_MAX;
+
+    for (uint32_t batch = 0; batch < count; batch += DSMA_INSTANCES_PER_BATCH)
+    {
+        uint32_t batch_count = count - batch;
+        if (batch_count > DSMA_INSTANCES_PER_BATCH)
+            batch_count = DSMA_INSTANCES_PER_BATCH;
+
+        const DSMA_Instance *batch_instances = &instances[batch];
+
+        for (uint32_t i = 0; i < batch_count; i++)
+        {
+            frames[i] = dsa_snap_frame(dsa, batch_instances[i].frame_interp)
+                      & frame_mask;
+        }
 
-    glCallList((uint32_t *)dsm_file);
+        for (uint32_t i = 0; i < batch_count; i++)
+        {
+            uint32_t frame_interp = frames[i];
+            if (frame_interp == drawn)
+                continue;
+
+            // The arguments have already been checked, so this can only fail if
+            // the DSA file is corrupted.
+            ret = DSMA_ComputePose(&pose_buffer[0], dsa_file, frame_interp);
+            if (ret != DSMA_SUCCESS)
+            {
+                MATRIX_POP = 1;
+                return ret;
+            }
+
+            for (uint32_t j = i; j < batch_count; j++)
+            {
+                if (frames[j] != frame_interp)
+                    continue;
+
+                frames[j] = drawn;
+
+                // Save the matrix of this instance
+                DSMA_STATS_ADD(gx_words_cpu, 14);
+                MATRIX_RESTORE = curr_stack_level;
+                matrix_mult_4x3(&batch_instances[j].matrix[0]);
+                MATRIX_STORE = instance_level;
+
+                for (uint32_t k = 0; k < num_joints; k++)
+                    joint_writer_add_matrix(&writer, k, &pose->matrix[k][0]);
+
+                joint_writer_flush(&writer);
+
+                gx_call_list((uint32_t *)dsm_file);
+            }
+        }
+    }
 
     MATRIX_POP = 1;
 
     return DSMA_SUCCESS;
 }
+
+ITCM_CODE ARM_CODE
+int DSMA_DrawModelBaked(const void *dsm_file, uint32_t frame_interp)
+{
+    const dsm_baked_t *dsm = dsm_file;
+
+    if (dsm->magic != DSM_BAKED_MAGIC)
+        return DSMA_INVALID_MODEL;
+
+    uint32_t num_frames = dsm->num_frames;
+
+    if ((frame_interp >> 12) >= num_frames)
+        return DSMA_INVALID_FRAME;
+
+    // Frames can't be interpolated, use the closest one
+    uint32_t frame = (frame_interp + (1 << 11)) >> 12;
+    if (frame == num_frames)
+        frame = 0;
+
+    stats_count_frame(0);
+
+    gx_call_list((uint32_t *)((uintptr_t)dsm + dsm->offset[frame]));
+
+    return DSMA_SUCCESS;
+}
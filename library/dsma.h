@@ -20,13 +20,156 @@ extern "C" {
 // Returns the number of frames stored in the specified DSA file.
 uint32_t DSMA_GetNumFrames(const void *dsa_file);
 
+// Returns the number of joints of the skeleton animated by the DSA file.
+uint32_t DSMA_GetNumJoints(const void *dsa_file);
+
+// Returns the hash of a name, as used by the index of container files. It can be
+// used to calculate the hashes of the names of files in advance.
+uint32_t DSMA_HashName(const char *name);
+
+// Returns the number of files stored in a container file generated by
+// md5_to_dsma with the option --container. It returns 0 if it isn't a valid
+// container.
+uint32_t DSMA_ContainerGetNumFiles(const void *container);
+
+// Looks for a file in a container by the hash of its name (calculated with
+// DSMA_HashName()). It returns a pointer to the file inside the container, or
+// NULL if the file isn't found or if it isn't a valid container. The pointer
+// can be passed to any function of the library, and it's valid while the
+// container stays loaded.
+//
+// The container must be aligned to 4 bytes.
+const void *DSMA_ContainerGetFileByHash(const void *container, uint32_t name_hash);
+
+// Like DSMA_ContainerGetFileByHash(), but it takes the name of the file (for
+// example, "robot.dsm" or "robot_walk.dsa").
+const void *DSMA_ContainerGetFile(const void *container, const char *name);
+
+// Function used by DSMA_StreamInit() to read from a DSA file. It must copy
+// 'size' bytes starting at 'offset' (from the start of the DSA file) to
+// 'buffer'. 'arg' is the value passed to DSMA_StreamInit(). It must return 0 on
+// success.
+typedef int (*DSMA_StreamReadFn)(void *arg, uint32_t offset, void *buffer,
+                                 uint32_t size);
+
+// Streaming animation. Don't modify its fields.
+typedef struct {
+    DSMA_StreamReadFn read;
+    void *arg;
+    void *buffer;         // Header of the DSA file followed by the window
+    uint32_t header_size; // Size of the header of the DSA file
+    uint32_t frame_size;  // Size of a frame in the DSA file
+    uint32_t num_frames;  // Number of frames of the animation
+    uint32_t window;      // Number of frames that fit in the buffer
+    uint32_t first_frame; // Frame of the animation in the first slot in use
+    uint32_t first_slot;  // First slot of the window in use
+    uint32_t count;       // Number of slots in use
+} DSMA_Stream;
+
+// Size in bytes of a buffer that can hold a window of the specified number of
+// frames (at least 2) of an animation of a skeleton with the specified number
+// of joints. It's enough for any DSA format that can be streamed.
+#define DSMA_STREAM_BUFFER_SIZE(num_joints, window) \
+    (sizeof(uint32_t) * (3 + 7 * (num_joints) * (window)))
+
+// Prepares a DSA file to be streamed, so that only a few frames need to be kept
+// in RAM at the same time, regardless of the length of the animation. The
+// frames are read with the provided function when they are needed. This is
+// useful for very long animations, like cutscenes. DSA files with tracks or with
+// matrices can't be streamed (it returns DSMA_INVALID_VERSION).
+//
+// The buffer must be aligned to 4 bytes. It holds the header of the DSA file
+// and as many frames as fit in it (at least 2). Use DSMA_STREAM_BUFFER_SIZE()
+// to get a size. A bigger window lets the stream read more frames at once.
+//
+// It returns a DSMA_* code (0 for success).
+int DSMA_StreamInit(DSMA_Stream *stream, void *buffer, size_t size,
+                    DSMA_StreamReadFn read, void *arg);
+
+// Makes sure that the frame of the animation (in 20.12 format) and the next one
+// are in the window of the stream, reading them if needed. Frames before the
+// requested one are removed from the window and new frames are read in their
+// place, so playing the animation forwards reads each frame once. Going back
+// in time reads the whole window again.
+//
+// The DSA file returned by DSMA_StreamGetDSA() can then be drawn at the frame
+// returned in 'local_frame_interp' with any drawing function of the library:
+//
+//     DSMA_StreamSetFrame(&stream, frame, &local_frame);
+//     DSMA_DrawModel(dsm_file, DSMA_StreamGetDSA(&stream), local_frame);
+//
+// It returns a DSMA_* code (0 for success).
+int DSMA_StreamSetFrame(DSMA_Stream *stream, uint32_t frame_interp,
+                        uint32_t *local_frame_interp);
+
+// Returns a DSA file that holds the window of frames of the stream. Its number
+// of frames is the size of the window, not the number of frames of the
+// animation.
+const void *DSMA_StreamGetDSA(const DSMA_Stream *stream);
+
+// Returns the number of frames of the animation of the stream.
+uint32_t DSMA_StreamGetNumFrames(const DSMA_Stream *stream);
+
+// Size in bytes of a command buffer that can hold the matrices of all the
+// joints of a model.
+#define DSMA_COMMAND_BUFFER_SIZE(num_joints) \
+    (sizeof(uint32_t) * (1 + 15 * (num_joints)))
+
+// Sets a buffer used by all the drawing functions of the library to build the
+// list of commands that load the matrices of the joints of a model. The list is
+// sent to the geometry engine with a DMA copy (with glCallList()) right before
+// the display list of the model, instead of writing each value to the geometry
+// engine registers with the CPU.
+//
+// The buffer must be aligned to 4 bytes, and it must be in main RAM (DMA can't
+// read from DTCM). Use DSMA_COMMAND_BUFFER_SIZE() with the highest number of
+// joints of your models to get the size. Drawing functions will return
+// DSMA_COMMAND_BUFFER_TOO_SMALL if a model doesn't fit in the buffer.
+//
+// Pass NULL to go back to writing the matrices to the registers directly.
+void DSMA_SetCommandBuffer(void *buffer, size_t size);
+
+// Interpolated orientations aren't normalized. This is the fastest mode, and
+// it works well when the frames of the animation are close to each other.
+#define DSMA_INTERPOLATION_FAST             0
+// Interpolated orientations are normalized with an approximation of the
+// inverse square root that uses a small table and a few multiplications.
+#define DSMA_INTERPOLATION_NORMALIZED       1
+// Interpolated orientations are normalized with the hardware square root and
+// division units. It is the most accurate mode, and the slowest one.
+#define DSMA_INTERPOLATION_NORMALIZED_EXACT 2
+
+// Sets the quality of the interpolation between two frames (and the blending
+// of several animations) used by all the drawing functions of the library.
+// Interpolating quaternions without normalizing the result makes the model
+// shrink slightly between frames that are very different, which may be
+// visible when the animation has few frames. The default is
+// DSMA_INTERPOLATION_FAST.
+void DSMA_SetInterpolationQuality(uint32_t quality);
+
 // Draws the model in the DSM file animated with the data in the specified DSA
 // file, at the requested frame.
 //
 // The frame is a fixed point value in 20.12 format (e.g. if you pass 3 << 12 as
 // value it corresponds to frame 3). Any value that isn't an exact frame number
 // will draw the model by interpolating the two closest frames. It wraps around:
-// when going over the max frame, it interpolates with frame 0.
+// when going over the max frame, it interpolates with frame 0. DSA files
+// exported with --snap-frames are never interpolated, the frame is rounded to
+// the nearest integer frame (in all functions of the library).
+//
+// The DSM file can be a regular model or a model split in segments. Segmented
+// models can use skeletons with more joints than the ones that fit in the
+// matrix stack: the matrices of the joints are loaded before each segment is
+// drawn. All other drawing functions support them too, unless stated otherwise.
+//
+// DSA files with precomputed matrices (exported with --matrices) can only be
+// used with this function and DSMA_ComputePose(). At exact frames the matrices
+// are sent to the geometry engine with a DMA copy, without any CPU work. Between
+// frames the matrices are interpolated linearly and they aren't
+// orthonormalized, so models get deformed between frames that are very
+// different (like the last and first frames of an animation that doesn't
+// loop). These files are meant to be used at integer frames, or exported with
+// --snap-frames.
 //
 // It returns a DSMA_* code (0 for success).
 ITCM_CODE ARM_CODE
@@ -49,12 +192,300 @@ int DSMA_DrawModelBlendAnimation(const void *dsm_file,
         const void *dsa_file_2, uint32_t frame_interp_2,
         uint32_t blend);
 
+// Like DSMA_DrawModelBlendAnimation(), but each joint has its own blending
+// factor. This is useful to layer animations, for example, to play a walk
+// animation with the legs while the upper body plays an attack animation.
+//
+// The mask is an array with one value per joint, in the same order as the
+// joints in the MD5 files. Each value goes from 0 to 4096 (1.0), like the
+// blending factor of DSMA_DrawModelBlendAnimation(). The value of each joint is
+// multiplied by 'blend', so that a layer can be faded in and out without
+// having to modify the mask.
+//
+// Joints with a final blending factor of 0.0 or 1.0 only read one of the two
+// animations, so they are as fast as in DSMA_DrawModel().
+//
+// It returns a DSMA_* code (0 for success).
+ITCM_CODE ARM_CODE
+int DSMA_DrawModelBlendAnimationMask(const void *dsm_file,
+        const void *dsa_file_1, uint32_t frame_interp_1,
+        const void *dsa_file_2, uint32_t frame_interp_2,
+        const uint16_t *blend_mask, uint32_t blend);
+
+// Max number of animations that can be blended by DSMA_DrawModelBlendMultiple()
+// and DSMA_ComputePoseBlendMultiple().
+#define DSMA_MAX_BLEND_SOURCES  8
+
+// Animation used by DSMA_DrawModelBlendMultiple().
+typedef struct {
+    const void *dsa_file;  // DSA file of the animation
+    uint32_t frame_interp; // Frame of the animation in 20.12 format
+    uint32_t weight;       // Weight of the animation in 20.12 format
+} DSMA_BlendSource;
+
+// Draws the model in the DSM file animated with a weighted average of several
+// animations. This is useful for blend spaces (for example, to mix idle, walk
+// and run animations depending on the speed of a character).
+//
+// All the DSA files must have the same number of joints, and the weights must
+// add up to 1.0 (4096). Animations with a weight of 0 are skipped, so they
+// don't cost any CPU time. Up to DSMA_MAX_BLEND_SOURCES animations can be
+// blended at the same time.
+//
+// All animations are blended in one pass, and only one matrix is generated for
+// each joint. This is much faster than blending the animations in pairs.
+//
+// It returns a DSMA_* code (0 for success).
+ITCM_CODE ARM_CODE
+int DSMA_DrawModelBlendMultiple(const void *dsm_file,
+                                const DSMA_BlendSource *sources, uint32_t count);
+
+// Size in bytes of a pose buffer for a skeleton with the specified number of
+// joints. A pose holds the final transformation matrix of each joint.
+#define DSMA_POSE_SIZE(num_joints)  (sizeof(uint32_t) * (1 + 12 * (num_joints)))
+
+// Calculates the pose of the skeleton animated by the DSA file at the requested
+// frame and stores it in the provided buffer, which must be at least
+// DSMA_POSE_SIZE(DSMA_GetNumJoints(dsa_file)) bytes in size and 4-byte
+// aligned.
+//
+// The frame is a fixed point value in 20.12 format, like in DSMA_DrawModel().
+// The pose can be drawn as many times as needed with DSMA_DrawModelPose(), with
+// any DSM file that uses the same skeleton.
+//
+// It returns a DSMA_* code (0 for success).
+ITCM_CODE ARM_CODE
+int DSMA_ComputePose(void *pose, const void *dsa_file, uint32_t frame_interp);
+
+// Calculates the pose that results from blending two animations, like in
+// DSMA_DrawModelBlendAnimation(), and stores it in the provided buffer.
+//
+// It returns a DSMA_* code (0 for success).
+ITCM_CODE ARM_CODE
+int DSMA_ComputePoseBlendAnimation(void *pose,
+        const void *dsa_file_1, uint32_t frame_interp_1,
+        const void *dsa_file_2, uint32_t frame_interp_2,
+        uint32_t blend);
+
+// Calculates the pose that results from blending two animations with a mask,
+// like in DSMA_DrawModelBlendAnimationMask(), and stores it in the provided
+// buffer.
+//
+// It returns a DSMA_* code (0 for success).
+ITCM_CODE ARM_CODE
+int DSMA_ComputePoseBlendAnimationMask(void *pose,
+        const void *dsa_file_1, uint32_t frame_interp_1,
+        const void *dsa_file_2, uint32_t frame_interp_2,
+        const uint16_t *blend_mask, uint32_t blend);
+
+// Calculates the pose that results from blending several animations, like in
+// DSMA_DrawModelBlendMultiple(), and stores it in the provided buffer.
+//
+// It returns a DSMA_* code (0 for success).
+ITCM_CODE ARM_CODE
+int DSMA_ComputePoseBlendMultiple(void *pose, const DSMA_BlendSource *sources,
+                                  uint32_t count);
+
+// Draws the model in the DSM file with a pose calculated by any of the
+// DSMA_ComputePose*() functions. This doesn't do any interpolation or
+// quaternion math, it only sends the stored matrices to the geometry engine.
+//
+// It returns a DSMA_* code (0 for success).
+ITCM_CODE ARM_CODE
+int DSMA_DrawModelPose(const void *dsm_file, const void *pose);
+
+// Instance of a model drawn with DSMA_DrawModelInstances().
+typedef struct {
+    // Frame of the animation in 20.12 format, like in DSMA_DrawModel().
+    uint32_t frame_interp;
+    // 4x3 matrix in 20.12 format that is multiplied by the current matrix
+    // before drawing this instance. It has the same layout as the one used by
+    // MATRIX_MULT4x3: the first 9 values are the rotation/scale part (by rows),
+    // and the last 3 values are the translation.
+    int32_t matrix[12];
+} DSMA_Instance;
+
+// Draws several instances of the model in the DSM file animated with the same
+// DSA file.
+//
+// The instances are grouped by frame so that the pose of each different frame
+// is only calculated once, regardless of the number of instances that use it.
+// Before grouping them, the lowest 'quantization_bits' bits of the frame of
+// each instance are cleared. For example, 0 keeps the frames as they are, 10
+// truncates them to multiples of 1/4 of a frame, and 12 truncates them to
+// whole frames (which also avoids interpolation). Values over 12 are treated
+// as 12.
+//
+// The instances aren't necessarily drawn in the order of the array. They are
+// grouped in batches of 64 instances, so instances in different batches that
+// use the same frame need to calculate the pose again. Grouping a batch takes
+// a time proportional to the number of instances multiplied by the number of
+// different frames, but it's much lower than the time needed to calculate a
+// pose.
+//
+// It needs one more level in the matrix stack than DSMA_DrawModel(). Models
+// split in segments aren't supported (it returns DSMA_INVALID_MODEL).
+//
+// It returns a DSMA_* code (0 for success). Nothing is drawn if it fails.
+ITCM_CODE ARM_CODE
+int DSMA_DrawModelInstances(const void *dsm_file, const void *dsa_file,
+                            const DSMA_Instance *instances, uint32_t count,
+                            uint32_t quantization_bits);
+
+// Draws a frame of a baked model. Baked models are generated by md5_to_dsma
+// with the option --bake. They have one display list per frame of an animation,
+// with the model already deformed, so drawing them doesn't need any joint math
+// and it doesn't use the matrix stack. This is useful for small models, where
+// the CPU time needed to calculate the joint matrices is higher than the time
+// needed to draw the polygons. However, baked models use a lot more memory.
+//
+// The frame is a fixed point value in 20.12 format, like in DSMA_DrawModel().
+// Frames can't be interpolated, so the closest frame is drawn. You can use
+// DSMA_GetNumFrames() with baked models to get their number of frames. Baked
+// models can't be used with any other drawing function.
+//
+// It returns a DSMA_* code (0 for success).
+ITCM_CODE ARM_CODE
+int DSMA_DrawModelBaked(const void *dsm_file, uint32_t frame_interp);
+
+// Checks if a model animated with a DSA file is inside the view volume, without
+// calculating any joint matrix. It uses a bounds file generated by md5_to_dsma
+// for the model and the animation (with the option --bounds), and the frame of
+// the animation in 20.12 format, like in DSMA_DrawModel(). This can be used to
+// skip models that are off screen before doing any work to draw them:
+//
+//     if (DSMA_TestBounds(bounds_file, frame) == 1)
+//         DSMA_DrawModel(dsm_file, dsa_file, frame);
+//
+// The test is done by the geometry engine with the BOX_TEST command using the
+// current matrices, so it must be called with the same matrices that would be
+// used to draw the model. The box of each frame contains the model in all the
+// interpolated positions until the next frame. Note that the result of
+// BOX_TEST is affected by some of the polygon attributes (check GBATEK).
+//
+// It returns 1 if the model is visible, 0 if it isn't, or a DSMA_* error code
+// (which are negative).
+int DSMA_TestBounds(const void *bounds_file, uint32_t frame_interp);
+
+// Statistics of the geometry drawn by a DSM file.
+typedef struct {
+    uint32_t num_polygons; // Polygons drawn
+    uint32_t num_vertices; // Vertices sent to the geometry engine
+    uint32_t num_words;    // Words of the display lists
+    uint32_t num_cycles;   // Estimated cycles of the geometry engine
+} DSMA_ModelStats;
+
+// Calculates the number of polygons and vertices drawn by a DSM file, and the
+// work done by the geometry engine to draw them. md5_to_dsma prints the same
+// values when it converts a model. This can be used to decide which models (or
+// levels of detail) to draw in a frame before drawing anything, so that the
+// polygon and vertex RAM of the hardware (2048 polygons and 6144 vertices) is
+// never exceeded.
+//
+// The display list is scanned every time this is called, so you should call it
+// when the model is loaded and save the result. The statistics of baked models
+// are the ones of their slowest frame. The commands sent by the library to load
+// the matrices of the joints (about 84 cycles per joint) aren't included.
+//
+// It returns a DSMA_* code (0 for success).
+int DSMA_GetModelStats(const void *dsm_file, DSMA_ModelStats *stats);
+
+// Level of detail of a model, used by DSMA_SelectLOD().
+typedef struct {
+    // Min size of the model on the screen needed to use this level. Any unit
+    // can be used (for example, the height of the model in pixels), as long as
+    // all levels and the size passed to DSMA_SelectLOD() use the same one.
+    int32_t min_size;
+    // Number of polygons drawn by this level. md5_to_dsma prints it when it
+    // converts a model, and DSMA_GetModelStats() can calculate it.
+    uint32_t num_polygons;
+} DSMA_LOD;
+
+// Picks the level of detail to use to draw a model. md5_to_dsma generates the
+// levels with the option --lod.
+//
+// The levels must be sorted from the most detailed one to the least detailed
+// one. It returns the index of the first level that has a min_size lower or
+// equal than 'size' and that doesn't draw more than 'max_polygons' polygons.
+// This lets you reduce the quality of far away models, and of all models when
+// there are too many polygons in the scene (the hardware can only draw 2048
+// polygons per frame).
+//
+// If no level can be used, it returns 'num_lods' and the model shouldn't be
+// drawn. Set the min_size of the last level to 0 and its number of polygons to
+// 0 if you want it to be used in that case.
+uint32_t DSMA_SelectLOD(const DSMA_LOD *lods, uint32_t num_lods, int32_t size,
+                        uint32_t max_polygons);
+
+// Counters collected by the library if it's built with DSMA_STATS defined. They
+// are useful to find out where the time goes in a slow frame. DSMA_STATS must
+// also be defined in the code that includes this header. If it isn't defined,
+// the library doesn't count anything and the functions below do nothing.
+typedef struct {
+    // Joint matrices calculated from the data of DSA files
+    uint32_t joints_evaluated;
+    // Frames of animations read at an integer frame, and between two frames
+    uint32_t frames_exact;
+    uint32_t frames_interpolated;
+    // Calls to functions that blend animations
+    uint32_t blends;
+    // Words written to geometry engine registers by the CPU to load the
+    // matrices of joints and instances
+    uint32_t gx_words_cpu;
+    // Words sent to the geometry engine with DMA copies (display lists of
+    // models, command buffers and frames of DSA files with matrices)
+    uint32_t gx_words_dma;
+    // Number of times that the status of the matrix stack was read while
+    // waiting for push and pop operations to end, and the time spent waiting
+    // according to the clock set with DSMA_SetStatsClock()
+    uint32_t stack_wait_polls;
+    uint32_t stack_wait_ticks;
+} DSMA_Stats;
+
+// Function that returns the current value of a clock in any unit (for example,
+// the value of two cascaded hardware timers). It may wrap around.
+typedef uint32_t (*DSMA_StatsClockFn)(void);
+
+#ifdef DSMA_STATS
+
+// Copies the current value of the counters to 'stats'.
+void DSMA_GetStats(DSMA_Stats *stats);
+
+// Sets all counters to zero.
+void DSMA_ResetStats(void);
+
+// Sets the clock used to measure the time spent waiting for the matrix stack.
+// By default there is no clock, and only the number of polls is counted.
+void DSMA_SetStatsClock(DSMA_StatsClockFn clock);
+
+#else
+
+static inline void DSMA_GetStats(DSMA_Stats *stats)
+{
+    *stats = (DSMA_Stats){ 0 };
+}
+
+static inline void DSMA_ResetStats(void)
+{
+}
+
+static inline void DSMA_SetStatsClock(DSMA_StatsClockFn clock)
+{
+    (void)clock;
+}
+
+#endif // DSMA_STATS
+
 #define DSMA_SUCCESS                    0
 #define DSMA_INVALID_VERSION            -1
 #define DSMA_INVALID_FRAME              -2
 #define DSMA_INVALID_BLENDING           -3
 #define DSMA_MATRIX_STACK_FULL          -4
 #define DSMA_INCOMPATIBLE_ANIMATIONS    -5
+#define DSMA_COMMAND_BUFFER_TOO_SMALL   -6
+#define DSMA_INVALID_MODEL              -7
+#define DSMA_STREAM_BUFFER_TOO_SMALL    -8
+#define DSMA_STREAM_READ_ERROR          -9
 
 #ifdef __cplusplus
 }
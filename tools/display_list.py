@@ -2,6 +2,13 @@
 #
 # Copyright (c) 2022 Antonio Niño Díaz <antonio_nd@outlook.com>
 
+from math import sqrt
+
+def sign_extend(val, bits):
+    if val & (1 << (bits - 1)):
+        return val - (1 << bits)
+    return val
+
 def float_to_v16(val):
     res = int(val * (1 << 12))
     if res < -0x8000:
@@ -23,7 +30,7 @@ def float_to_f32(val):
     return res
 
 def v16_to_float(val):
-    return val / (1 << 12)
+    return sign_extend(val, 16) / (1 << 12)
 
 def float_to_v10(val):
     res = int(val * (1 << 6))
@@ -36,10 +43,13 @@ def float_to_v10(val):
     return res
 
 def v10_to_float(val):
-    return val / (1 << 6)
+    return sign_extend(val, 10) / (1 << 6)
 
 def float_to_diff10(val):
-    res = int(val * (1 << 9))
+    # The differences are in the same units as VTX_16 (1/4096). They are rounded
+    # to the nearest value because the error is measured against the position
+    # of the previous vertex that the hardware has actually stored.
+    res = round(val * (1 << 12))
     if res < -0x200:
         raise OverflowError(f"{val} too small for diff10: {res:#03x}")
     if res > 0x1FF:
@@ -49,7 +59,7 @@ def float_to_diff10(val):
     return res
 
 def diff10_to_float(val):
-    return val / (1 << 9)
+    return sign_extend(val, 10) / (1 << 12)
 
 def float_to_t16(val):
     res = int(val * (1 << 4))
@@ -73,48 +83,62 @@ def float_to_n10(val):
         res = 0x400 + res
     return res
 
+# Information about all the commands of the geometry engine: ID, number of
+# parameters and cycles that the geometry engine needs to execute them (from
+# GBATEK). NORMAL takes between 9 and 12 cycles depending on the number of
+# lights that are enabled, the worst case is used here. Vertex commands don't
+# include the time needed to set up the polygons.
+COMMANDS = {
+    "NOP": (0x00, 0, 0),                # No Operation (for padding packed GXFIFO commands)
+    "MTX_MODE": (0x10, 1, 1),           # Set Matrix Mode
+    "MTX_PUSH": (0x11, 0, 17),          # Push Current Matrix on Stack
+    "MTX_POP": (0x12, 1, 36),           # Pop Current Matrix from Stack
+    "MTX_STORE": (0x13, 1, 17),         # Store Current Matrix on Stack
+    "MTX_RESTORE": (0x14, 1, 36),       # Restore Current Matrix from Stack
+    "MTX_IDENTITY": (0x15, 0, 19),      # Load Unit Matrix to Current Matrix
+    "MTX_LOAD_4x4": (0x16, 16, 34),     # Load 4x4 Matrix to Current Matrix
+    "MTX_LOAD_4x3": (0x17, 12, 30),     # Load 4x3 Matrix to Current Matrix
+    "MTX_MULT_4x4": (0x18, 16, 35),     # Multiply Current Matrix by 4x4 Matrix
+    "MTX_MULT_4x3": (0x19, 12, 31),     # Multiply Current Matrix by 4x3 Matrix
+    "MTX_MULT_3x3": (0x1A, 9, 28),      # Multiply Current Matrix by 3x3 Matrix
+    "MTX_SCALE": (0x1B, 3, 22),         # Multiply Current Matrix by Scale Matrix
+    "MTX_TRANS": (0x1C, 3, 22),         # Mult. Curr. Matrix by Translation Matrix
+    "COLOR": (0x20, 1, 1),              # Directly Set Vertex Color
+    "NORMAL": (0x21, 1, 12),            # Set Normal Vector
+    "TEXCOORD": (0x22, 1, 1),           # Set Texture Coordinates
+    "VTX_16": (0x23, 2, 9),             # Set Vertex XYZ Coordinates
+    "VTX_10": (0x24, 1, 8),             # Set Vertex XYZ Coordinates
+    "VTX_XY": (0x25, 1, 8),             # Set Vertex XY Coordinates
+    "VTX_XZ": (0x26, 1, 8),             # Set Vertex XZ Coordinates
+    "VTX_YZ": (0x27, 1, 8),             # Set Vertex YZ Coordinates
+    "VTX_DIFF": (0x28, 1, 8),           # Set Relative Vertex Coordinates
+    "POLYGON_ATTR": (0x29, 1, 1),       # Set Polygon Attributes
+    "TEXIMAGE_PARAM": (0x2A, 1, 1),     # Set Texture Parameters
+    "PLTT_BASE": (0x2B, 1, 1),          # Set Texture Palette Base Address
+    "DIF_AMB": (0x30, 1, 4),            # MaterialColor0 # Diffuse/Ambient Reflect.
+    "SPE_EMI": (0x31, 1, 4),            # MaterialColor1 # Specular Ref. & Emission
+    "LIGHT_VECTOR": (0x32, 1, 6),       # Set Light's Directional Vector
+    "LIGHT_COLOR": (0x33, 1, 1),        # Set Light Color
+    "SHININESS": (0x34, 32, 32),        # Specular Reflection Shininess Table
+    "BEGIN_VTXS": (0x40, 1, 1),         # Start of Vertex List
+    "END_VTXS": (0x41, 0, 1),           # End of Vertex List
+    "SWAP_BUFFERS": (0x50, 1, 392),     # Swap Rendering Engine Buffer
+    "VIEWPORT": (0x60, 1, 1),           # Set Viewport
+    "BOX_TEST": (0x70, 3, 103),         # Test if Cuboid Sits inside View Volume
+    "POS_TEST": (0x71, 2, 9),           # Set Position Coordinates for Test
+    "VEC_TEST": (0x72, 1, 5),           # Set Directional Vector for Test
+}
+
+COMMAND_ID_TO_NAME = { info[0]: name for name, info in COMMANDS.items() }
+
 def command_name_to_id(name):
-    commands = {
-        "NOP": 0x00, # (0) No Operation (for padding packed GXFIFO commands)
-        "MTX_MODE": 0x10, # (1) Set Matrix Mode
-        "MTX_PUSH": 0x11,  # (0) Push Current Matrix on Stack
-        "MTX_POP": 0x12, # (1) Pop Current Matrix from Stack
-        "MTX_STORE": 0x13, # (1) Store Current Matrix on Stack
-        "MTX_RESTORE": 0x14, # (1) Restore Current Matrix from Stack
-        "MTX_IDENTITY": 0x15, # (0) Load Unit Matrix to Current Matrix
-        "MTX_LOAD_4x4": 0x16, # (16) Load 4x4 Matrix to Current Matrix
-        "MTX_LOAD_4x3": 0x17, # (12) Load 4x3 Matrix to Current Matrix
-        "MTX_MULT_4x4": 0x18, # (16) Multiply Current Matrix by 4x4 Matrix
-        "MTX_MULT_4x3": 0x19, # (12) Multiply Current Matrix by 4x3 Matrix
-        "MTX_MULT_3x3": 0x1A, # (9) Multiply Current Matrix by 3x3 Matrix
-        "MTX_SCALE": 0x1B, # (3) Multiply Current Matrix by Scale Matrix
-        "MTX_TRANS": 0x1C, # (3) Mult. Curr. Matrix by Translation Matrix
-        "COLOR": 0x20, # (1) Directly Set Vertex Color
-        "NORMAL": 0x21, # (1) Set Normal Vector
-        "TEXCOORD": 0x22, # (1) Set Texture Coordinates
-        "VTX_16": 0x23, # (2) Set Vertex XYZ Coordinates
-        "VTX_10": 0x24, # (1) Set Vertex XYZ Coordinates
-        "VTX_XY": 0x25, # (1) Set Vertex XY Coordinates
-        "VTX_XZ": 0x26, # (1) Set Vertex XZ Coordinates
-        "VTX_YZ": 0x27, # (1) Set Vertex YZ Coordinates
-        "VTX_DIFF": 0x28, # (1) Set Relative Vertex Coordinates
-        "POLYGON_ATTR": 0x29, # (1) Set Polygon Attributes
-        "TEXIMAGE_PARAM": 0x2A, # (1) Set Texture Parameters
-        "PLTT_BASE": 0x2B, # (1) Set Texture Palette Base Address
-        "DIF_AMB": 0x30, # (1) MaterialColor0 # Diffuse/Ambient Reflect.
-        "SPE_EMI": 0x31, # (1) MaterialColor1 # Specular Ref. & Emission
-        "LIGHT_VECTOR": 0x32, # (1) Set Light's Directional Vector
-        "LIGHT_COLOR": 0x33, # (1) Set Light Color
-        "SHININESS": 0x34, # (32) Specular Reflection Shininess Table
-        "BEGIN_VTXS": 0x40, # (1) Start of Vertex List
-        "END_VTXS": 0x41, # (0) End of Vertex List
-        "SWAP_BUFFERS": 0x50, # (1) Swap Rendering Engine Buffer
-        "VIEWPORT": 0x60, # (1) Set Viewport
-        "BOX_TEST": 0x70, # (3) Test if Cuboid Sits inside View Volume
-        "POS_TEST": 0x71, # (2) Set Position Coordinates for Test
-        "VEC_TEST": 0x72, # (1) Set Directional Vector for Test
-    }
-    return commands[name]
+    return COMMANDS[name][0]
+
+def command_num_params(name):
+    return COMMANDS[name][1]
+
+def command_cycles(name):
+    return COMMANDS[name][2]
 
 def poly_type_to_id(name):
     types = {
@@ -125,22 +149,78 @@ def poly_type_to_id(name):
     }
     return types[name]
 
-def error(x1, x2, y1, y2, z1, z2):
-    return (abs(x1 - x2) ** 2) + (abs(y1 - y2) ** 2) + (abs(z1 - z2) ** 2)
+def polygons_in_list(poly_type, num_vertices):
+    """
+    Returns the number of polygons drawn by a list of vertices started with
+    BEGIN_VTXS. 'poly_type' is the parameter of BEGIN_VTXS.
+    """
+    if poly_type == poly_type_to_id("triangles"):
+        return num_vertices // 3
+    if poly_type == poly_type_to_id("quads"):
+        return num_vertices // 4
+    if num_vertices < 3:
+        return 0
+    if poly_type == poly_type_to_id("triangle_strip"):
+        return num_vertices - 2
+    return (num_vertices - 2) // 2
+
+def error(a, b):
+    return sqrt(((a[0] - b[0]) ** 2) + ((a[1] - b[1]) ** 2) + ((a[2] - b[2]) ** 2))
+
+VTX_COMMANDS = ["VTX_16", "VTX_10", "VTX_XY", "VTX_XZ", "VTX_YZ", "VTX_DIFF"]
 
 class DisplayList():
 
-    def __init__(self):
+    def __init__(self, max_vtx_error=None):
+        """
+        'max_vtx_error' is the max distance between the position of a vertex and
+        the one drawn by the hardware when a command other than VTX_16 is used.
+        If it is None, other commands are only used if they are as accurate as
+        VTX_16.
+        """
         self.commands = []
         self.parameters = []
+        # Coordinates of the last vertex as stored by the hardware
         self.vtx_last = None
         self.texcoord_last = None
         self.normal_last = None
         self.begin_vtx_last = None
 
+        self.max_vtx_error = max_vtx_error
+
+        # Number of vertices sent with each command, and error of the vertices
+        self.vtx_stats = { name: 0 for name in VTX_COMMANDS }
+        self.vtx_error_max = 0
+        self.vtx_error_sum = 0
+
+        # Statistics of the commands added to the display list
+        self.num_polygons = 0
+        self.num_vertices = 0
+        self.num_cycles = 0
+        self.list_type = None
+        self.list_vertices = 0
+
         self.display_list = []
 
+    def end_list_stats(self):
+        if self.list_type is not None:
+            self.num_polygons += polygons_in_list(self.list_type,
+                                                  self.list_vertices)
+        self.list_type = None
+        self.list_vertices = 0
+
     def add_command(self, command, *args):
+        name = COMMAND_ID_TO_NAME[command]
+        self.num_cycles += command_cycles(name)
+        if name in VTX_COMMANDS:
+            self.num_vertices += 1
+            self.list_vertices += 1
+        elif name == "BEGIN_VTXS":
+            self.end_list_stats()
+            self.list_type = args[0]
+        elif name == "END_VTXS":
+            self.end_list_stats()
+
         self.commands.append(command)
         if len(args) > 0:
             self.parameters.extend(args)
@@ -162,9 +242,16 @@ class DisplayList():
             for i in range(padding):
                 self.nop()
 
+        # Lists that haven't been closed with END_VTXS are still drawn
+        self.end_list_stats()
+
         # Prepend size to the list
         self.display_list.insert(0, len(self.display_list))
 
+    def num_words(self):
+        """Returns the number of words sent to the geometry engine."""
+        return len(self.display_list) - 1
+
     def save_to_file(self, path):
         with open(path, "wb") as f:
             for u32 in self.display_list:
@@ -185,6 +272,10 @@ class DisplayList():
 
     def mtx_restore(self, index):
         self.add_command(command_name_to_id("MTX_RESTORE"), index)
+        # The lighting of a normal is calculated with the matrix that is active
+        # when the NORMAL command is sent, so it must be sent again even if it
+        # has the same value.
+        self.normal_last = None
 
     def mtx_load_4x3(self, m):
         fixed_m = [float_to_f32(v) for v in m]
@@ -199,100 +290,147 @@ class DisplayList():
         self.add_command(command_name_to_id("COLOR"), arg)
 
     def normal(self, x, y, z):
-        # Skip if it's the same normal
-        if self.normal_last is not None:
-            if self.normal_last[0] == x and self.normal_last[1] == y and \
-               self.normal_last[2] == z:
-                return
-
         arg = float_to_n10(x) | (float_to_n10(y) << 10) | float_to_n10(z) << 20
+
+        # Skip if it's the same normal after the conversion to fixed point
+        if self.normal_last == arg:
+            return
+
         self.add_command(command_name_to_id("NORMAL"), arg)
-        self.normal_last = (x, y, z)
+        self.normal_last = arg
 
     def texcoord(self, u, v):
-        # Skip if it's the same texcoord
-        if self.texcoord_last is not None:
-            if self.texcoord_last[0] == u and self.texcoord_last[1] == v:
-                return
-
         arg = float_to_t16(u) | (float_to_t16(v) << 16)
+
+        # Skip if it's the same texcoord after the conversion to fixed point
+        if self.texcoord_last == arg:
+            return
+
         self.add_command(command_name_to_id("TEXCOORD"), arg)
-        self.texcoord_last = (u, v)
+        self.texcoord_last = arg
 
     def vtx_16(self, x, y, z):
         args = [float_to_v16(x) | (float_to_v16(y) << 16), float_to_v16(z)]
         self.add_command(command_name_to_id("VTX_16"), *args)
-        self.vtx_last = (x, y, z)
+        self.vtx_last = (v16_to_float(float_to_v16(x)),
+                         v16_to_float(float_to_v16(y)),
+                         v16_to_float(float_to_v16(z)))
 
     def vtx_10(self, x, y, z):
         arg = float_to_v10(x) | (float_to_v10(y) << 10) | float_to_v10(z) << 20
         self.add_command(command_name_to_id("VTX_10"), arg)
-        self.vtx_last = (x, y, z)
+        self.vtx_last = (v10_to_float(float_to_v10(x)),
+                         v10_to_float(float_to_v10(y)),
+                         v10_to_float(float_to_v10(z)))
 
     def vtx_xy(self, x, y):
         arg = float_to_v16(x) | (float_to_v16(y) << 16)
         self.add_command(command_name_to_id("VTX_XY"), arg)
-        self.vtx_last = (x, y, self.vtx_last[2])
+        self.vtx_last = (v16_to_float(float_to_v16(x)),
+                         v16_to_float(float_to_v16(y)), self.vtx_last[2])
 
     def vtx_xz(self, x, z):
         arg = float_to_v16(x) | (float_to_v16(z) << 16)
         self.add_command(command_name_to_id("VTX_XZ"), arg)
-        self.vtx_last = (x, self.vtx_last[1], z)
+        self.vtx_last = (v16_to_float(float_to_v16(x)), self.vtx_last[1],
+                         v16_to_float(float_to_v16(z)))
 
     def vtx_yz(self, y, z):
         arg = float_to_v16(y) | (float_to_v16(z) << 16)
         self.add_command(command_name_to_id("VTX_YZ"), arg)
-        self.vtx_last = (self.vtx_last[0], y, z)
+        self.vtx_last = (self.vtx_last[0], v16_to_float(float_to_v16(y)),
+                         v16_to_float(float_to_v16(z)))
 
     def vtx_diff(self, x, y, z):
-        arg = float_to_diff10(x - self.vtx_last[0]) | \
-             (float_to_diff10(y - self.vtx_last[1]) << 10) | \
-             (float_to_diff10(z - self.vtx_last[2]) << 20)
+        dx = float_to_diff10(x - self.vtx_last[0])
+        dy = float_to_diff10(y - self.vtx_last[1])
+        dz = float_to_diff10(z - self.vtx_last[2])
+        arg = dx | (dy << 10) | (dz << 20)
         self.add_command(command_name_to_id("VTX_DIFF"), arg)
-        self.vtx_last = (x, y, z)
+        self.vtx_last = (self.vtx_last[0] + diff10_to_float(dx),
+                         self.vtx_last[1] + diff10_to_float(dy),
+                         self.vtx_last[2] + diff10_to_float(dz))
+
+    def vtx_options(self, x, y, z):
+        """
+        Returns a list of (name, size in words, position stored by the
+        hardware) of all the commands that can be used to send a vertex.
+        """
+        options = []
+
+        v16 = (v16_to_float(float_to_v16(x)), v16_to_float(float_to_v16(y)),
+               v16_to_float(float_to_v16(z)))
+        options.append(("VTX_16", 2, v16))
+
+        # The commands that reuse coordinates of the previous vertex use the
+        # values stored by the hardware, not the ones that were requested.
+        last = self.vtx_last
+        if last is not None:
+            options.append(("VTX_YZ", 1, (last[0], v16[1], v16[2])))
+            options.append(("VTX_XZ", 1, (v16[0], last[1], v16[2])))
+            options.append(("VTX_XY", 1, (v16[0], v16[1], last[2])))
+
+            try:
+                diff = (diff10_to_float(float_to_diff10(x - last[0])),
+                        diff10_to_float(float_to_diff10(y - last[1])),
+                        diff10_to_float(float_to_diff10(z - last[2])))
+                options.append(("VTX_DIFF", 1, (last[0] + diff[0],
+                                                last[1] + diff[1],
+                                                last[2] + diff[2])))
+            except OverflowError:
+                pass
+
+        try:
+            options.append(("VTX_10", 1, (v10_to_float(float_to_v10(x)),
+                                          v10_to_float(float_to_v10(y)),
+                                          v10_to_float(float_to_v10(z)))))
+        except OverflowError:
+            pass
+
+        return options
 
     def vtx(self, x, y, z):
         """
-        Picks the best vtx command based on the previous vertex and the error of
-        the conversion.
+        Picks the smallest vtx command that keeps the error of the vertex under
+        the limit. The error is calculated with the position that the hardware
+        will actually store, so the error of commands that depend on the
+        previous vertex doesn't accumulate.
         """
-        # Allow {vtx_xy, vtx_yz, vtx_xz, vtx_diff} if there is a previous vertex
-        allow_diff = self.vtx_last is not None
-
-        # First, check if any of the coordinates is exactly the same as the
-        # previous command. We can trivially use vtx_xy, vtx_xz, vtx_yz because
-        # they have the min possible size and the max possible accuracy
-        if allow_diff:
-            if float_to_v16(self.vtx_last[0]) == float_to_v16(x):
-                self.vtx_yz(y, z)
-                return
-            elif float_to_v16(self.vtx_last[1]) == float_to_v16(y):
-                self.vtx_xz(x, z)
-                return
-            elif float_to_v16(self.vtx_last[2]) == float_to_v16(z):
-                self.vtx_xy(x, y)
-                return
-
-        # If not, there are three options: vtx_16, vtx_10, vtx_diff. Pick the
-        # one with the lowest error.
-
-        # TODO: Maybe use vtx_diff, but this may cause accuracy issues if it is
-        # used several times in a row.
-
-        error_vtx_16 = error(v16_to_float(float_to_v16(x)), x,
-                             v16_to_float(float_to_v16(y)), y,
-                             v16_to_float(float_to_v16(z)), z)
-
-        error_vtx_10 = error(v10_to_float(float_to_v10(x)), x,
-                             v10_to_float(float_to_v10(y)), y,
-                             v10_to_float(float_to_v10(z)), z)
-
-        if error_vtx_10 <= error_vtx_16:
-            self.vtx_10(x, y, z)
-        else:
+        options = self.vtx_options(x, y, z)
+
+        # VTX_16 is always the first option
+        max_error = error(options[0][2], (x, y, z))
+        if self.max_vtx_error is not None:
+            max_error = max(max_error, self.max_vtx_error)
+
+        # Pick the smallest command, and the most accurate one among the ones
+        # with the same size. In case of a tie, the first one is used.
+        best = None
+        for name, size, pos in options:
+            err = error(pos, (x, y, z))
+            if err > max_error + 1e-9:
+                continue
+            if best is None or (size, err) < (best[1], best[3]):
+                best = (name, size, pos, err)
+
+        name, _, _, err = best
+
+        if name == "VTX_16":
             self.vtx_16(x, y, z)
-
-        return
+        elif name == "VTX_10":
+            self.vtx_10(x, y, z)
+        elif name == "VTX_XY":
+            self.vtx_xy(x, y)
+        elif name == "VTX_XZ":
+            self.vtx_xz(x, z)
+        elif name == "VTX_YZ":
+            self.vtx_yz(y, z)
+        elif name == "VTX_DIFF":
+            self.vtx_diff(x, y, z)
+
+        self.vtx_stats[name] += 1
+        self.vtx_error_max = max(self.vtx_error_max, err)
+        self.vtx_error_sum += err
 
     def begin_vtxs(self, poly_type):
         self.add_command(command_name_to_id("BEGIN_VTXS"), poly_type_to_id(poly_type))
@@ -0,0 +1,482 @@
+#!/usr/bin/env python3
+
+# SPDX-License-Identifier: MIT
+#
+# Copyright (c) 2022 Antonio Niño Díaz <antonio_nd@outlook.com>
+
+# Estimates the cost of drawing DSM files animated with DSA files without
+# running them. It decodes the display lists with the table of commands of
+# display_list.py and adds the commands that the library sends at runtime to
+# load the matrices of the joints.
+
+from display_list import COMMAND_ID_TO_NAME, VTX_COMMANDS, command_cycles, command_num_params, polygons_in_list
+from md5_to_dsma import DSMA_CONTAINER_MAGIC, get_container_name, load_u32_array, name_hash
+
+DSM_SEGMENTED_MAGIC = 0x4D534453 # "SDSM"
+DSM_BAKED_MAGIC = 0x4D534442 # "BDSM"
+DSA_BOUNDS_MAGIC = 0x42415344 # "DSAB"
+
+# The version number of DSA files has flags in the upper bits
+DSA_VERSION_MASK = 0xFF
+DSA_FLAG_SNAP_FRAMES = 0x100
+
+DSA_VERSION_NAMES = {
+    1: "full frames",
+    2: "compact",
+    3: "tracks",
+    4: "matrices",
+}
+
+# Max number of joints that can fit in the matrix stack
+DSMA_MAX_JOINTS = 30
+
+# Commands sent by the library to load the matrix of a joint: restore the matrix
+# of the model, multiply it by the matrix of the joint, and store the result in
+# the stack.
+JOINT_COMMANDS = ["MTX_RESTORE", "MTX_MULT_4x3", "MTX_STORE"]
+
+# Words per joint when the commands are written to the registers of the
+# geometry engine (one per parameter) or sent as a packed command list (one
+# more for the command IDs).
+JOINT_WORDS_REGISTERS = 14
+JOINT_WORDS_PACKED = 15
+
+class Cost():
+
+    def __init__(self):
+        self.histogram = {}
+        self.words = 0
+        self.polygons = 0
+        self.vertices = 0
+        self.cycles = 0
+        self.joint_loads = 0
+
+    def add_command(self, name, count=1):
+        self.histogram[name] = self.histogram.get(name, 0) + count
+        self.cycles += command_cycles(name) * count
+        if name in VTX_COMMANDS:
+            self.vertices += count
+
+    def add_joints(self, count, packed):
+        self.joint_loads += count
+        for name in JOINT_COMMANDS:
+            self.add_command(name, count)
+        if packed:
+            self.words += JOINT_WORDS_PACKED * count
+        else:
+            self.words += JOINT_WORDS_REGISTERS * count
+
+    def add(self, other):
+        for name, count in other.histogram.items():
+            self.histogram[name] = self.histogram.get(name, 0) + count
+        self.words += other.words
+        self.polygons += other.polygons
+        self.vertices += other.vertices
+        self.cycles += other.cycles
+        self.joint_loads += other.joint_loads
+
+    def print_summary(self, indent="  "):
+        print(f"{indent}Words:    {self.words}")
+        print(f"{indent}Polygons: {self.polygons}")
+        print(f"{indent}Vertices: {self.vertices}")
+        print(f"{indent}Cycles:   {self.cycles}")
+
+    def print_histogram(self, indent="  "):
+        print(f"{indent}Commands:")
+
+        # Sort commands by the time they take, the most expensive first
+        rows = sorted(self.histogram.items(),
+                      key=lambda item: (-command_cycles(item[0]) * item[1], item[0]))
+        for name, count in rows:
+            if name == "NOP":
+                continue
+            cycles = command_cycles(name) * count
+            print(f"{indent}  {name:14} {count:7} ({cycles} cycles)")
+
+def decode_display_list(data, start):
+    """
+    Decodes the display list at index 'start' of 'data' (a list of words). The
+    first word is the number of words of the list, like in glCallList(). It
+    returns a Cost with the contents of the list. It also returns the min
+    parameter of MTX_RESTORE commands, or None if there aren't any.
+    """
+    if start >= len(data):
+        raise Exception(f"Display list out of bounds: {start}")
+
+    size = data[start]
+    end = start + 1 + size
+    if end > len(data):
+        raise Exception(f"Display list too big: {size} words")
+
+    cost = Cost()
+    cost.words = size
+
+    poly_type = None
+    list_vertices = 0
+    min_restore = None
+
+    i = start + 1
+    while i < end:
+        header = data[i]
+        i += 1
+
+        for shift in range(0, 32, 8):
+            command = (header >> shift) & 0xFF
+            if command not in COMMAND_ID_TO_NAME:
+                raise Exception(f"Invalid command in display list: {command:#04x}")
+
+            name = COMMAND_ID_TO_NAME[command]
+            cost.add_command(name)
+
+            if name in VTX_COMMANDS:
+                list_vertices += 1
+            elif name in ["BEGIN_VTXS", "END_VTXS"]:
+                if poly_type is not None:
+                    cost.polygons += polygons_in_list(poly_type, list_vertices)
+                poly_type = (data[i] & 3) if name == "BEGIN_VTXS" else None
+                list_vertices = 0
+            elif name == "MTX_RESTORE":
+                index = data[i] & 0x1F
+                if min_restore is None or index < min_restore:
+                    min_restore = index
+
+            i += command_num_params(name)
+
+    # Lists that aren't closed with END_VTXS are still drawn
+    if poly_type is not None:
+        cost.polygons += polygons_in_list(poly_type, list_vertices)
+
+    if i != end:
+        raise Exception("The last command of the display list is incomplete")
+
+    return cost, min_restore
+
+def segment_list_start(data, offset):
+    """
+    Returns the index of the display list of the segment of a segmented DSM file
+    at byte offset 'offset', and the indices of the joints it loads.
+    """
+    index = offset // 4
+    num_loads = data[index]
+    joints = []
+    for j in range(num_loads):
+        word = data[index + 1 + j // 2]
+        joints.append((word >> ((j % 2) * 16 + 8)) & 0xFF)
+    return index + 1 + (num_loads + 1) // 2, joints
+
+class Model():
+
+    def __init__(self, name, data):
+        self.name = name
+        self.data = data
+
+        if data[0] == DSM_SEGMENTED_MAGIC:
+            self.kind = "segmented"
+            num_segments = data[1]
+            self.segment_size = data[2]
+            self.num_joints = data[3]
+
+            # Each segment is a list of joints to load and a display list
+            self.segments = []
+            for i in range(num_segments):
+                start, joints = segment_list_start(data, data[4 + i])
+                cost, _ = decode_display_list(data, start)
+                self.segments.append((joints, cost))
+
+        elif data[0] == DSM_BAKED_MAGIC:
+            self.kind = "baked"
+            num_frames = data[1]
+            self.frames = [decode_display_list(data, data[2 + i] // 4)[0]
+                           for i in range(num_frames)]
+
+        else:
+            self.kind = "display list"
+            self.cost, min_restore = decode_display_list(data, 0)
+
+            # The display list restores the matrix of each joint from the slot
+            # base_matrix + joint, and base_matrix is 31 - num_joints, so the
+            # lowest slot tells the min number of joints the model needs.
+            if min_restore is None:
+                self.num_joints = 0
+            else:
+                self.num_joints = DSMA_MAX_JOINTS + 1 - min_restore
+
+    def print(self):
+        print(f"{self.name}: DSM file ({self.kind})")
+
+        if self.kind == "segmented":
+            print(f"  Segments:     {len(self.segments)}")
+            print(f"  Segment size: {self.segment_size}")
+            print(f"  Joints:       {self.num_joints}")
+            cost = Cost()
+            for _, segment_cost in self.segments:
+                cost.add(segment_cost)
+            cost.print_summary()
+            cost.print_histogram()
+
+        elif self.kind == "baked":
+            frames = self.frames
+            print(f"  Frames: {len(frames)}")
+            worst = max(range(len(frames)), key=lambda i: frames[i].cycles)
+            average = sum(f.cycles for f in frames) / len(frames)
+            print(f"  Cycles: {average:.1f} per frame on average")
+            print(f"  Slowest frame: {worst}")
+            frames[worst].print_summary("    ")
+            frames[worst].print_histogram("    ")
+
+        else:
+            # The slots used by the display list depend on the number of joints
+            # of the animation, this is only the minimum.
+            print(f"  Joints:   {self.num_joints} or more")
+            self.cost.print_summary()
+            self.cost.print_histogram()
+
+        print("")
+
+    def draw_cost(self, anim, packed):
+        """
+        Returns the cost of drawing the model with an animation, including the
+        commands sent by the library, or None if the model can't be drawn with
+        it. If 'packed' is True, the matrices of the joints are sent with a
+        command buffer instead of being written to the registers.
+        """
+        cost = Cost()
+
+        if self.kind == "baked":
+            # Only one frame is drawn at a time, use the slowest one
+            cost.add(max(self.frames, key=lambda f: f.cycles))
+            return cost
+
+        if anim is None:
+            return None
+
+        if self.kind == "segmented":
+            if self.num_joints > anim.num_joints:
+                return None
+
+            # The matrices are always calculated by the CPU, even the ones of
+            # DSA files with matrices.
+            cost.add_command("MTX_PUSH")
+            cost.words += 1
+            for joints, segment_cost in self.segments:
+                cost.add_joints(len(joints), packed)
+                cost.add(segment_cost)
+            cost.add_command("MTX_POP")
+            cost.words += 1
+            return cost
+
+        if (self.num_joints > anim.num_joints) or \
+           (anim.num_joints > DSMA_MAX_JOINTS):
+            return None
+
+        if anim.version == 4:
+            # The matrix of the model is stored in the slot before the first
+            # joint instead of being pushed, and the frames of the file are
+            # command lists that are sent as they are.
+            cost.add_command("MTX_STORE")
+            cost.words += 1
+            cost.add_joints(anim.num_joints, True)
+            cost.add(self.cost)
+            cost.add_command("MTX_RESTORE")
+            cost.words += 1
+        else:
+            cost.add_command("MTX_PUSH")
+            cost.words += 1
+            cost.add_joints(anim.num_joints, packed)
+            cost.add(self.cost)
+            cost.add_command("MTX_POP")
+            cost.words += 1
+
+        return cost
+
+class Animation():
+
+    def __init__(self, name, data):
+        self.name = name
+        self.data = data
+
+        self.version = data[0] & DSA_VERSION_MASK
+        self.flags = data[0] & ~DSA_VERSION_MASK
+        self.num_frames = data[1]
+        self.num_joints = data[2]
+
+        nj = self.num_joints
+
+        if self.version == 1:
+            expected = 3 + self.num_frames * nj * 7
+        elif self.version == 2:
+            self.pos_shift = data[3]
+            self.num_animated = data[4]
+            slot_words = (nj + 3) // 4
+            static_joints = nj - self.num_animated
+            # Each compact joint is 7 halfwords
+            halfwords = (static_joints + self.num_frames * self.num_animated) * 7
+            expected = 5 + slot_words + (halfwords + 1) // 2
+        elif self.version == 3:
+            self.pos_shift = data[3]
+            self.num_keys = sum(data[4 + j * 2] & 0xFFFF for j in range(nj))
+            expected = None
+        elif self.version == 4:
+            for frame in range(self.num_frames):
+                start = 3 + frame * (1 + JOINT_WORDS_PACKED * nj)
+                if data[start] != JOINT_WORDS_PACKED * nj:
+                    raise Exception(f"Invalid command list in frame {frame}")
+            expected = 3 + self.num_frames * (1 + JOINT_WORDS_PACKED * nj)
+        else:
+            raise Exception(f"Unknown DSA version: {self.version}")
+
+        # Files inside a container may be followed by other files
+        if expected is not None and expected > len(data):
+            raise Exception(f"DSA file too small: {len(data)} words, expected {expected}")
+
+    def print(self):
+        print(f"{self.name}: DSA file (version {self.version}, "
+              f"{DSA_VERSION_NAMES[self.version]})")
+        print(f"  Frames: {self.num_frames}")
+        print(f"  Joints: {self.num_joints}")
+
+        if self.version == 2:
+            print(f"  Animated joints: {self.num_animated}")
+        elif self.version == 3:
+            print(f"  Keys: {self.num_keys} ({self.num_keys / self.num_joints:.1f} per joint)")
+
+        flags = []
+        if self.flags & DSA_FLAG_SNAP_FRAMES:
+            flags.append("snap frames")
+        unknown = self.flags & ~DSA_FLAG_SNAP_FRAMES
+        if unknown != 0:
+            flags.append(f"unknown {unknown:#x}")
+        if len(flags) > 0:
+            print(f"  Flags: {', '.join(flags)}")
+
+        if self.num_joints > DSMA_MAX_JOINTS:
+            print(f"  Warning: Too many joints for the matrix stack, only "
+                  f"segmented models can use it")
+
+        print("")
+
+class Bounds():
+
+    def __init__(self, name, data):
+        self.name = name
+        self.num_frames = data[1]
+
+    def print(self):
+        print(f"{self.name}: Bounds file")
+        print(f"  Frames: {self.num_frames}")
+        print(f"  Cycles: {command_cycles('BOX_TEST')} per test (BOX_TEST)")
+        print("")
+
+def load_file(name, file_type, data, files, names):
+    """
+    Adds a file to the right list of 'files'. Containers are expanded. The type
+    of the file is the extension of its name ("dsm", "dsa" or "dsb"), or None if
+    it isn't known. 'names' is a dictionary that maps the hashes of the names of
+    files inside containers to their names.
+    """
+    if len(data) < 2:
+        raise Exception(f"{name}: File too small")
+
+    # The files that have a magic number can always be identified
+    if data[0] == DSMA_CONTAINER_MAGIC:
+        num_files = data[1]
+        # The data of a file may continue after the next one starts (shared
+        # tracks), so each file gets everything until the end of the container.
+        for i in range(num_files):
+            entry_hash = data[2 + i * 2]
+            offset = data[2 + i * 2 + 1] // 4
+            if entry_hash in names:
+                entry_name = names[entry_hash]
+                entry_type = entry_name.split(".")[-1]
+            else:
+                entry_name = f"{entry_hash:08X}"
+                entry_type = None
+            load_file(f"{name}[{entry_name}]", entry_type, data[offset:],
+                      files, names)
+    elif data[0] == DSA_BOUNDS_MAGIC:
+        files["bounds"].append(Bounds(name, data))
+    elif data[0] in [DSM_SEGMENTED_MAGIC, DSM_BAKED_MAGIC]:
+        files["models"].append(Model(name, data))
+    elif file_type == "dsm":
+        files["models"].append(Model(name, data))
+    elif file_type == "dsa":
+        files["anims"].append(Animation(name, data))
+    elif (data[0] & DSA_VERSION_MASK) not in DSA_VERSION_NAMES:
+        # Regular DSM files are just a display list, so the first word is its
+        # size. It can only be a DSA file if it looks like a valid version.
+        files["models"].append(Model(name, data))
+    else:
+        print(f"WARNING: {name}: Can't tell if it's a DSM or a DSA file, skipped. "
+              "Pass the names of the files of the container with --names.")
+        print("")
+
+if __name__ == "__main__":
+
+    import argparse
+    import sys
+    import traceback
+
+    parser = argparse.ArgumentParser(
+            description='Estimates the cost of drawing DSM files animated with DSA files.')
+
+    parser.add_argument("files", nargs="+",
+                        help="DSM, DSA, bounds and container files")
+    parser.add_argument("--command-buffer", required=False,
+                        action='store_true',
+                        help="assume that the matrices of the joints are sent with a command buffer (DSMA_SetCommandBuffer())")
+    parser.add_argument("--names", required=False, type=str, default=[],
+                        nargs="+", action="extend",
+                        help="names of the files inside containers (e.g. 'robot.dsm robot_walk.dsa'), used to tell their type")
+    parser.add_argument("--histograms", required=False,
+                        action='store_true',
+                        help="also print the histogram of commands of each draw")
+
+    args = parser.parse_args()
+
+    try:
+        files = { "models": [], "anims": [], "bounds": [] }
+
+        names = { name_hash(name): name for name in args.names }
+
+        for path in args.files:
+            file_type = get_container_name(path).split(".")[-1]
+            load_file(path, file_type, load_u32_array(path), files, names)
+
+        models = files["models"]
+        anims = files["anims"]
+
+        for f in models + anims + files["bounds"]:
+            f.print()
+
+        # Estimate the cost of drawing each model with each animation
+        for model in models:
+            pairs = [None] if model.kind == "baked" else anims
+            for anim in pairs:
+                cost = model.draw_cost(anim, args.command_buffer)
+                if cost is None:
+                    continue
+
+                if anim is None:
+                    print(f"Draw {model.name}:")
+                else:
+                    print(f"Draw {model.name} with {anim.name}:")
+
+                cost.print_summary()
+
+                if cost.joint_loads > 0:
+                    joint_cycles = sum(command_cycles(name) for name in JOINT_COMMANDS)
+                    print(f"  Joints:   {cost.joint_loads} loads, {joint_cycles} "
+                          f"cycles each ({cost.joint_loads * joint_cycles} cycles)")
+
+                if args.histograms:
+                    cost.print_histogram()
+                print("")
+
+    except BaseException as e:
+        print("ERROR: " + str(e))
+        traceback.print_exc()
+        sys.exit(1)
+    except:
+        print("ERROR: Unknown error")
+        traceback.print_exc()
+        sys.exit(1)
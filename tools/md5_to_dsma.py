@@ -4,12 +4,14 @@
 #
 # Copyright (c) 2022 Antonio Niño Díaz <antonio_nd@outlook.com>
 
+import heapq
 import os
 
 from collections import namedtuple
-from math import sqrt
+from itertools import product
+from math import acos, ceil, floor, sin, sqrt
 
-from display_list import DisplayList, float_to_f32
+from display_list import DisplayList, VTX_COMMANDS, command_cycles, command_name_to_id, float_to_f32, float_to_n10, float_to_t16
 
 class MD5FormatError(Exception):
     pass
@@ -40,6 +42,37 @@ class Quaternion():
         mag = sqrt((self.w ** 2) + (self.x ** 2) + (self.y ** 2) + (self.z ** 2))
         return Quaternion(self.w / mag, self.x /mag, self.y / mag, self.z / mag)
 
+    def negate(self):
+        return Quaternion(-self.w, -self.x, -self.y, -self.z)
+
+    def dot(self, other):
+        return (self.w * other.w) + (self.x * other.x) + (self.y * other.y) + (self.z * other.z)
+
+    def slerp(self, other, t):
+        """
+        Spherical linear interpolation between two unit quaternions. It always
+        takes the shortest path between both orientations.
+        """
+        d = self.dot(other)
+        if d < 0:
+            other = other.negate()
+            d = -d
+
+        if d > 0.9995:
+            # The quaternions are almost equal, so nlerp is accurate enough and
+            # it avoids dividing by a number close to zero.
+            return Quaternion(self.w + (other.w - self.w) * t,
+                              self.x + (other.x - self.x) * t,
+                              self.y + (other.y - self.y) * t,
+                              self.z + (other.z - self.z) * t).normalize()
+
+        theta = acos(d)
+        sin_theta = sin(theta)
+        a = sin((1 - t) * theta) / sin_theta
+        b = sin(t * theta) / sin_theta
+        return Quaternion(self.w * a + other.w * b, self.x * a + other.x * b,
+                          self.y * a + other.y * b, self.z * a + other.z * b)
+
     def mul(self, other):
         w = (self.w * other.w) - (self.x * other.x) - (self.y * other.y) - (self.z * other.z)
         x = (self.x * other.w) + (self.w * other.x) + (self.y * other.z) - (self.z * other.y)
@@ -82,6 +115,9 @@ class Vector():
     def sub(self, other):
         return Vector(self.x - other.x, self.y - other.y, self.z - other.z)
 
+    def scale(self, s):
+        return Vector(self.x * s, self.y * s, self.z * s)
+
     def cross(self, other):
         x = (self.y * other.z) - (other.y * self.z)
         y = (self.z * other.x) - (other.z * self.x)
@@ -347,6 +383,7 @@ def parse_md5anim(input_file):
 
         numFrames = None
         numJoints = None
+        frameRate = None
 
         baseframe = []
         hierarchy = []
@@ -400,8 +437,10 @@ def parse_md5anim(input_file):
                         raise MD5FormatError(f"'numJoints' is 0")
 
                 elif cmd == 'frameRate':
-                    # Ignore this
-                    pass
+                    assert_num_args('frameRate', nargs, 1, tokens)
+                    frameRate = float(tokens[0])
+                    if frameRate <= 0:
+                        raise MD5FormatError(f"Invalid 'frameRate': {frameRate}")
 
                 elif cmd == 'numAnimatedComponents':
                     # Ignore this
@@ -548,40 +587,109 @@ def parse_md5anim(input_file):
     if numFrames != realFrames:
         raise MD5FormatError(f"Incorrect number of frames: {numFrames} != {realFrames}")
 
-    return frames
+    return (frames, frameRate)
 
-def save_animation(frames, output_file, blender_fix):
+def resample_frames(frames, frame_rate, target_rate):
+    """
+    Resamples the frames of an animation to a different frame rate. Positions
+    are interpolated linearly and orientations with slerp. Animations loop, so
+    the last frame is interpolated with the first one. The number of frames is
+    rounded so that the duration of the loop doesn't change.
+    """
+    if frame_rate is None:
+        raise MD5FormatError("The animation doesn't have a 'frameRate'")
 
-    version = 1
     num_frames = len(frames)
-    num_bones = len(frames[0])
+    new_num_frames = max(1, round(num_frames * target_rate / frame_rate))
 
-    u32_array = [version, num_frames, num_bones]
+    result = []
 
-    for joints in frames:
-        if num_bones != len(joints):
-            raise MD5FormatError("Different number of bones across frames")
+    for i in range(new_num_frames):
+        src = i * num_frames / new_num_frames
+        index = floor(src)
+        t = src - index
+
+        joints_a = frames[index]
+        joints_b = frames[(index + 1) % num_frames]
+
+        joints = []
+        for a, b in zip(joints_a, joints_b):
+            pos = a.pos.add(b.pos.sub(a.pos).scale(t))
+            orient = a.orient.slerp(b.orient, t)
+            joints.append(a._replace(pos=pos, orient=orient))
+        result.append(joints)
+
+    print(f"  Resampled {num_frames} frames at {frame_rate:g} Hz to "
+          f"{new_num_frames} frames at {target_rate:g} Hz")
+
+    return result
+
+def select_frames(frames, frame_rate, skip_frames, resample_rate):
+    """
+    Returns the frames of an animation that have to be exported: one out of
+    every skip_frames + 1 frames, or all of them resampled to resample_rate
+    frames per second if it isn't None.
+    """
+    if resample_rate is not None:
+        return resample_frames(frames, frame_rate, resample_rate)
+
+    return frames[::skip_frames+1]
+
+def fix_joint_orientation(joint, blender_fix):
+    """
+    Returns the position and orientation of a joint ready to be exported.
+    """
+    this_pos = joint.pos
+    this_orient = joint.orient
+
+    if blender_fix:
+        # It is needed to rotate all bones because all bones have absolute
+        # transformations. Rotate orientation and position by -90 degrees on
+        # the X axis.
+        q_rot = Quaternion(0.7071068, -0.7071068, 0, 0)
+        this_orient = q_rot.mul(this_orient)
+        this_pos = Vector(this_pos.x, this_pos.z, -this_pos.y)
+
+    return this_pos, this_orient
+
+def float_to_s16(val, shift):
+    """
+    Converts a value to a signed 16-bit fixed point value with 12 fractional
+    bits, shifted right by the specified number of bits.
+    """
+    res = int(val * (1 << 12)) >> shift
+    if res < -0x8000:
+        raise OverflowError(f"{val} too small for s16 (shift {shift}): {res:#04x}")
+    if res > 0x7FFF:
+        raise OverflowError(f"{val} too big for s16 (shift {shift}): {res:#04x}")
+    if res < 0:
+        res = 0x10000 + res
+    return res
+
+def calculate_pos_shift(positions):
+    """
+    Returns the smallest shift that lets all the provided positions be stored
+    as signed 16-bit values.
+    """
+    max_abs = 0
+    for pos in positions:
+        for v in (pos.x, pos.y, pos.z):
+            max_abs = max(max_abs, abs(int(v * (1 << 12))))
 
-        for joint in joints:
-            this_pos = joint.pos
-            this_orient = joint.orient
+    shift = 0
+    while (max_abs >> shift) > 0x7FFF:
+        shift += 1
 
-            if blender_fix:
-                # It is needed to rotate all bones because all bones have
-                # absolute transformations. Rotate orientation and position by
-                # -90 degrees on the X axis.
-                q_rot = Quaternion(0.7071068, -0.7071068, 0, 0)
-                this_orient = q_rot.mul(this_orient)
-                this_pos = Vector(this_pos.x, this_pos.z, -this_pos.y)
+    return shift
 
-            pos = [float_to_f32(this_pos.x), float_to_f32(this_pos.y),
-                   float_to_f32(this_pos.z)]
-            orient = [float_to_f32(this_orient.w), float_to_f32(this_orient.x),
-                      float_to_f32(this_orient.y), float_to_f32(this_orient.z)]
+def u16_array_to_u32_array(u16_array):
+    if len(u16_array) % 2 != 0:
+        u16_array = u16_array + [0]
 
-            u32_array.extend(pos)
-            u32_array.extend(orient)
+    return [u16_array[i] | (u16_array[i + 1] << 16)
+            for i in range(0, len(u16_array), 2)]
 
+def save_u32_array(u32_array, output_file):
     with open(output_file, "wb") as f:
         for u32 in u32_array:
             b = [u32 & 0xFF, \
@@ -590,9 +698,1268 @@ def save_animation(frames, output_file, blender_fix):
                 (u32 >> 24) & 0xFF]
             f.write(bytearray(b))
 
+def make_quaternions_continuous(frames):
+    """
+    Quaternions q and -q represent the same orientation, but interpolating
+    between two quaternions that are in opposite hemispheres makes the joint
+    rotate the long way around (and the interpolated quaternion gets close to
+    zero in the middle). This flips the orientations that are in the opposite
+    hemisphere of the orientation of the same joint in the previous frame.
+    """
+    num_flipped = 0
+    result = [frames[0]]
+
+    for joints in frames[1:]:
+        new_joints = []
+        for (this_pos, this_orient), (_, prev_orient) in zip(joints, result[-1]):
+            if this_orient.dot(prev_orient) < 0:
+                this_orient = this_orient.negate()
+                num_flipped += 1
+            new_joints.append((this_pos, this_orient))
+        result.append(new_joints)
+
+    if num_flipped > 0:
+        print(f"  Flipped orientations: {num_flipped}")
+
+    # Animations loop, so the last frame is interpolated with the first one.
+    # The number of sign changes around the loop can't be changed by flipping
+    # quaternions, so this can only be reported.
+    if len(result) > 1:
+        num_bad = sum(1 for (_, a), (_, b) in zip(result[-1], result[0])
+                      if a.dot(b) < 0)
+        if num_bad > 0:
+            print(f"  WARNING: {num_bad} joints take the long way around when "
+                  "interpolating the last frame with the first one")
+
+    return result
+
+def interpolate_joint(a, b, t, normalize=False):
+    """
+    Interpolates two joints (tuples of position and orientation) the same way
+    as the library does it (lerp for the position, nlerp for the orientation,
+    without normalization unless requested).
+    """
+    pos_a, orient_a = a
+    pos_b, orient_b = b
+
+    def lerp(x, y):
+        return x + (y - x) * t
+
+    pos = Vector(lerp(pos_a.x, pos_b.x), lerp(pos_a.y, pos_b.y),
+                 lerp(pos_a.z, pos_b.z))
+    orient = Quaternion(lerp(orient_a.w, orient_b.w), lerp(orient_a.x, orient_b.x),
+                        lerp(orient_a.y, orient_b.y), lerp(orient_a.z, orient_b.z))
+    if normalize:
+        orient = orient.normalize()
+    return (pos, orient)
+
+def joint_error(a, b):
+    """
+    Returns the biggest difference between two joints. It compares positions in
+    model units and orientations as quaternion components.
+    """
+    pos_a, orient_a = a
+    pos_b, orient_b = b
+
+    pos_error = pos_a.sub(pos_b).length()
+    orient_error = max(abs(orient_a.w - orient_b.w), abs(orient_a.x - orient_b.x),
+                       abs(orient_a.y - orient_b.y), abs(orient_a.z - orient_b.z))
+
+    return max(pos_error, orient_error)
+
+def reduce_keyframes(values, tolerance):
+    """
+    Returns the list of frames that need to be kept so that the interpolation
+    between them reconstructs all the values with an error under the
+    tolerance. The first frame is always kept. Animations loop, so the last
+    frame is interpolated with the first one.
+    """
+    num_frames = len(values)
+    values = values + [values[0]]
+
+    keys = [0]
+    start = 0
+
+    while start < num_frames:
+        # Extend the segment that starts at this key as much as possible
+        best = start + 1
+        for end in range(start + 2, num_frames + 1):
+            span = end - start
+            valid = True
+            for f in range(start + 1, end):
+                v = interpolate_joint(values[start], values[end], (f - start) / span)
+                if joint_error(v, values[f]) > tolerance:
+                    valid = False
+                    break
+            if not valid:
+                break
+            best = end
+
+        if best < num_frames:
+            keys.append(best)
+        start = best
+
+    return keys
+
+DSA_FLAG_SNAP_FRAMES = 0x100
+
+def save_animation(frames, output_file, blender_fix, compact=False,
+                   keyframe_tolerance=None, matrices=False, snap_frames=False):
+
+    num_frames = len(frames)
+    num_bones = len(frames[0])
+
+    for joints in frames:
+        if num_bones != len(joints):
+            raise MD5FormatError("Different number of bones across frames")
+
+    frames = [[fix_joint_orientation(joint, blender_fix) for joint in joints]
+              for joints in frames]
+    frames = make_quaternions_continuous(frames)
+
+    if matrices:
+        # Each frame is a command list that the library can send to the
+        # geometry engine as it is. For each joint: restore the matrix of the
+        # model (stored right before the first joint), multiply it by the
+        # matrix of the joint and store the result in the slot of the joint.
+        # This uses the same slots as the library for regular DSA files.
+        # Skeletons that don't fit in the matrix stack can only be used with
+        # segmented models, and the library doesn't use the commands of the
+        # file in that case.
+        version = 4
+
+        base_matrix = 30 - num_bones + 1 if num_bones <= 30 else 1
+
+        u32_array = [version, num_frames, num_bones]
+
+        for joints in frames:
+            # 15 words per joint: packed commands and 14 parameters
+            u32_array.append(num_bones * 15)
+
+            for bone, (this_pos, this_orient) in enumerate(joints):
+                m = joint_info_to_m4x3(this_orient, this_pos)
+
+                u32_array.append(command_name_to_id("MTX_RESTORE") |
+                                 (command_name_to_id("MTX_MULT_4x3") << 8) |
+                                 (command_name_to_id("MTX_STORE") << 16))
+                u32_array.append(base_matrix - 1)
+                # Matrices are sent by columns
+                for col in range(4):
+                    for row in range(3):
+                        u32_array.append(float_to_f32(m[row][col]))
+                u32_array.append((base_matrix + bone) & 0x1F)
+
+        print(f"  Size: {len(u32_array) * 4} bytes")
+
+    elif keyframe_tolerance is not None:
+        # Each joint has its own track with its own keyframes. A track is
+        # formed by a list of keys (frame index of the key and the inverse of
+        # the number of frames until the next key) and a list of compact
+        # joints.
+        version = 3
+
+        # The frames of the keys are stored as 16-bit values
+        if num_frames > 0xFFFF:
+            raise Exception(f"Too many frames for --keyframe-tolerance: {num_frames}")
+
+        pos_shift = calculate_pos_shift(
+                [this_pos for joints in frames for this_pos, _ in joints])
+
+        header = [version, num_frames, num_bones, pos_shift]
+        header_size = (len(header) + (num_bones * 2)) * 4
+
+        tracks = []
+        data = []
+
+        total_keys = 0
+
+        for bone in range(num_bones):
+            values = [joints[bone] for joints in frames]
+            keys = reduce_keyframes(values, keyframe_tolerance)
+            total_keys += len(keys)
+
+            tracks.append(len(keys))
+            tracks.append(header_size + len(data) * 4)
+
+            for i, key in enumerate(keys):
+                next_key = keys[i + 1] if i + 1 < len(keys) else num_frames
+                span = next_key - key
+                # The inverse is rounded so that the interpolation reaches the
+                # next key. It doesn't fit in 16 bits if the span is 1 frame, so
+                # that case is stored as 0.
+                inv_span = 0 if span == 1 else round((1 << 16) / span)
+                data.append(key | (inv_span << 16))
+
+            u16_array = []
+            for key in keys:
+                this_pos, this_orient = values[key]
+                u16_array.extend([float_to_s16(this_pos.x, pos_shift),
+                                  float_to_s16(this_pos.y, pos_shift),
+                                  float_to_s16(this_pos.z, pos_shift)])
+                u16_array.extend([float_to_s16(this_orient.w, 0),
+                                  float_to_s16(this_orient.x, 0),
+                                  float_to_s16(this_orient.y, 0),
+                                  float_to_s16(this_orient.z, 0)])
+            data.extend(u16_array_to_u32_array(u16_array))
+
+        print(f"  Keyframes: {total_keys} / {num_frames * num_bones}")
+
+        u32_array = header + tracks + data
+
+    elif not compact:
+        version = 1
+
+        u32_array = [version, num_frames, num_bones]
+
+        for joints in frames:
+            for this_pos, this_orient in joints:
+                pos = [float_to_f32(this_pos.x), float_to_f32(this_pos.y),
+                       float_to_f32(this_pos.z)]
+                orient = [float_to_f32(this_orient.w), float_to_f32(this_orient.x),
+                          float_to_f32(this_orient.y), float_to_f32(this_orient.z)]
+
+                u32_array.extend(pos)
+                u32_array.extend(orient)
+    else:
+        # Orientations are stored as 16-bit values with 12 fractional bits, so
+        # they have the same precision as in the regular format. Positions are
+        # stored as 16-bit values, shifted right by the smallest amount that
+        # lets the biggest value of the animation fit in 16 bits.
+        version = 2
+
+        pos_shift = calculate_pos_shift(
+                [this_pos for joints in frames for this_pos, _ in joints])
+
+        def joint_to_u16(this_pos, this_orient):
+            return [float_to_s16(this_pos.x, pos_shift),
+                    float_to_s16(this_pos.y, pos_shift),
+                    float_to_s16(this_pos.z, pos_shift),
+                    float_to_s16(this_orient.w, 0),
+                    float_to_s16(this_orient.x, 0),
+                    float_to_s16(this_orient.y, 0),
+                    float_to_s16(this_orient.z, 0)]
+
+        quantized = [[joint_to_u16(*joint) for joint in joints] for joints in frames]
+
+        # Joints with the same values in all frames are only stored once.
+        animated = []
+        static = []
+        for bone in range(num_bones):
+            values = [joints[bone] for joints in quantized]
+            if all(v == values[0] for v in values):
+                static.append(bone)
+            else:
+                animated.append(bone)
+
+        print(f"  Static joints: {len(static)} / {num_bones}")
+
+        slots = [0] * num_bones
+        for i, bone in enumerate(animated):
+            slots[bone] = i
+        for i, bone in enumerate(static):
+            slots[bone] = len(animated) + i
+
+        u32_array = [version, num_frames, num_bones, pos_shift, len(animated)]
+
+        # Slots are stored as bytes, padded to a multiple of 4 bytes.
+        slots = slots + [0] * (-len(slots) % 4)
+        for i in range(0, len(slots), 4):
+            u32_array.append(slots[i] | (slots[i + 1] << 8) |
+                             (slots[i + 2] << 16) | (slots[i + 3] << 24))
+
+        u16_array = []
+
+        for bone in static:
+            u16_array.extend(quantized[0][bone])
+
+        for joints in quantized:
+            for bone in animated:
+                u16_array.extend(joints[bone])
+
+        u32_array.extend(u16_array_to_u32_array(u16_array))
+
+    # The flags are stored in the upper bits of the version number
+    if snap_frames:
+        u32_array[0] |= DSA_FLAG_SNAP_FRAMES
+
+    save_u32_array(u32_array, output_file)
+
+def get_joint_space_normal(joint, norm):
+    """
+    Transforms a normal in model space to the space of a joint.
+    """
+    q = joint.orient
+    qt = q.complement()
+    n = norm.to_q()
+
+    # Transform by the inverted quaternion
+    n = qt.mul(n).mul(q).to_v3()
+    if n.length() > 0:
+        n = n.normalize()
+    return n
+
+def add_vertex_to_display_list(dl, vert, weight, norm, joints, texture_size,
+                               force_restore, joint_matrix, last_joint_index):
+    """
+    Adds a vertex to a display list, with its texture coordinates and normal.
+    'norm' is the normal of the polygon in model space. 'joint_matrix' is the
+    index of the matrix of the stack that holds each joint. It returns the index
+    of the last joint loaded by the display list.
+    """
+
+    # Texture
+    # -------
+
+    st = vert.st
+    # In the MD5 format (0, 0) is the top-left corner, same as what
+    # the GPU of the DS expects.
+    u = st[0] * texture_size[0]
+    v = st[1] * texture_size[1]
+    dl.texcoord(u, v)
+
+    # Vertex and normal
+    # -----------------
+
+    # Load joint matrix. When drawing normal polygons it has to be
+    # loaded every time, because drawing the normal restores the
+    # original matrix.
+
+    joint_index = weight.joint
+    if force_restore or joint_index != last_joint_index:
+        dl.mtx_restore(joint_matrix[joint_index])
+        last_joint_index = joint_index
+
+    # Calculate normal in joint space
+
+    n = get_joint_space_normal(joints[joint_index], norm)
+    dl.normal(n.x, n.y, n.z)
+
+    # The vertex is already in joint space
+
+    dl.vtx(weight.pos.x, weight.pos.y, weight.pos.z)
+
+    return last_joint_index
+
+def add_triangle_to_display_list(dl, mesh, tri, norm, joints, texture_size,
+                                 draw_normal_polygons, joint_matrix,
+                                 last_joint_index):
+    """
+    Adds a triangle to a display list. 'joint_matrix' is the index of the matrix
+    of the stack that holds each joint. It returns the index of the last joint
+    loaded by the display list.
+    """
+    verts = [mesh.verts[i] for i in tri]
+    weights = [mesh.weights[v.startWeight] for v in verts]
+
+    finals = []
+
+    for vert, weight in zip(verts, weights):
+
+        last_joint_index = add_vertex_to_display_list(dl, vert, weight, norm,
+                joints, texture_size, draw_normal_polygons, joint_matrix,
+                last_joint_index)
+
+        if draw_normal_polygons:
+            # Calculate actual location of the vertex so that the
+            # vertices of the triangle can be averaged as origin of the
+            # normal polygon.
+            joint = joints[weight.joint]
+            q = joint.orient
+            qt = q.complement()
+            v = weight.pos.to_q()
+
+            delta = q.mul(v).mul(qt).to_v3()
+
+            final = joint.pos.add(delta)
+            finals.append(final)
+
+    if draw_normal_polygons:
+
+        # Don't use any of the joint transformation matrices
+        dl.mtx_restore(1)
+
+        vert_avg = Vector(
+            (finals[0].x + finals[1].x + finals[2].x) / 3,
+            (finals[0].y + finals[1].y + finals[2].y) / 3,
+            (finals[0].z + finals[1].z + finals[2].z) / 3
+        )
+
+        vert_avg_end = vert_avg.add(norm)
+
+        dl.texcoord(0, 0)
+
+        dl.color(1, 0, 0)
+        dl.vtx(vert_avg.x + 0.1, vert_avg.y, vert_avg.z)
+        dl.vtx(vert_avg.x, vert_avg.y, vert_avg.z)
+        dl.color(0, 1, 0)
+        dl.vtx(vert_avg_end.x, vert_avg_end.y, vert_avg_end.z)
+
+        dl.color(1, 0, 0)
+        dl.vtx(vert_avg.x, vert_avg.y, vert_avg.z)
+        dl.vtx(vert_avg.x, vert_avg.y + 0.1, vert_avg.z)
+        dl.color(0, 1, 0)
+        dl.vtx(vert_avg_end.x, vert_avg_end.y, vert_avg_end.z)
+
+        dl.color(1, 0, 0)
+        dl.vtx(vert_avg.x, vert_avg.y, vert_avg.z)
+        dl.vtx(vert_avg.x, vert_avg.y, vert_avg.z + 0.1)
+        dl.color(0, 1, 0)
+        dl.vtx(vert_avg_end.x, vert_avg_end.y, vert_avg_end.z)
+
+    return last_joint_index
+
+def get_polygon_vertex(mesh, index):
+    """
+    Returns the data of a vertex of a mesh that is sent to the display list. Two
+    vertices with the same data can be shared by adjacent polygons.
+    """
+    vert = mesh.verts[index]
+    weight = mesh.weights[vert.startWeight]
+    pos = weight.pos
+    return (weight.joint, pos.x, pos.y, pos.z, vert.st[0], vert.st[1])
+
+def stripify(triangles, joints):
+    """
+    Groups the triangles in quads, triangle strips and quad strips. Only
+    polygons with the same normal are joined because each vertex of a strip is
+    shared by several polygons, and they need to have the same normal to be lit
+    the same way as the original triangles.
+
+    Vertices only have one joint each, and the joint matrix is restored before
+    each vertex that needs it, so strips aren't limited to one joint.
+
+    It returns a list of (poly_type, polygons) pairs. Each polygon is a tuple of
+    (mesh, vertex indices, normal). Strips have one vertex per index instead.
+    """
+    # Data of the vertices of the triangles
+    keys = []
+    normal_keys = []
+    positions = []
+
+    for index, (mesh, tri, norm) in enumerate(triangles):
+        keys.append([get_polygon_vertex(mesh, i) for i in tri])
+
+        if norm.length() > 0:
+            normal_keys.append((mesh, float_to_n10(norm.x), float_to_n10(norm.y),
+                                float_to_n10(norm.z)))
+        else:
+            # Degenerate triangles can't be joined to anything
+            normal_keys.append(("degenerate", index))
+
+        pos = []
+        for i in tri:
+            weight = mesh.weights[mesh.verts[i].startWeight]
+            joint = joints[weight.joint]
+            m = joint_info_to_m4x3(joint.orient, joint.pos)
+            pos.append(weight.pos.mul_m4x3(m))
+        positions.append(pos)
+
+    # Map of directed edges to the triangles that contain them. Adjacent
+    # triangles with the same winding use their shared edge in opposite
+    # directions.
+    tri_edges = {}
+    for index, k in enumerate(keys):
+        for e in range(3):
+            edge = (k[e], k[(e + 1) % 3])
+            tri_edges.setdefault(edge, []).append(index)
+
+    def find_triangle(edge, normal_key, used):
+        for other in tri_edges.get(edge, []):
+            if not used[other] and normal_keys[other] == normal_key:
+                return other
+        return None
+
+    def is_convex(pos):
+        n = pos[0].sub(pos[1]).cross(pos[1].sub(pos[2]))
+        for i in range(len(pos)):
+            a = pos[i].sub(pos[(i + 1) % len(pos)])
+            b = pos[(i + 1) % len(pos)].sub(pos[(i + 2) % len(pos)])
+            c = a.cross(b)
+            if c.x * n.x + c.y * n.y + c.z * n.z <= 0:
+                return False
+        return True
+
+    # Join pairs of triangles into quads
+    # ----------------------------------
+
+    # Each quad is a tuple of (keys, indices, triangle used to draw it)
+    quads = []
+    used = [False] * len(triangles)
+
+    for index, k in enumerate(keys):
+        if used[index]:
+            continue
+
+        mesh, tri, _ = triangles[index]
+
+        for e in range(3):
+            # Rotate the triangle so that the shared edge is c -> a
+            a, b, c = [(e + i + 1) % 3 for i in range(3)]
+            other = find_triangle((k[a], k[c]), normal_keys[index], used)
+            if other is None or other == index:
+                continue
+
+            other_mesh, other_tri, _ = triangles[other]
+            if other_mesh is not mesh:
+                continue
+
+            # Find the vertex of the other triangle that isn't shared
+            ko = keys[other]
+            d = [i for i in range(3) if ko[i] != k[a] and ko[i] != k[c]]
+            if len(d) != 1:
+                continue
+            d = d[0]
+
+            pos = [positions[index][a], positions[index][b],
+                   positions[index][c], positions[other][d]]
+            if not is_convex(pos):
+                continue
+
+            used[index] = True
+            used[other] = True
+            quads.append(([k[a], k[b], k[c], ko[d]],
+                          [tri[a], tri[b], tri[c], other_tri[d]], index))
+            break
+
+    tris_left = [i for i in range(len(triangles)) if not used[i]]
+
+    # Join quads into quad strips
+    # ---------------------------
+
+    quad_edges = {}
+    for index, (k, _, _) in enumerate(quads):
+        for e in range(4):
+            edge = (k[e], k[(e + 1) % 4])
+            quad_edges.setdefault(edge, []).append(index)
+
+    def quad_strip(start, rotation, quad_used):
+        # The first quad (q0, q1, q2, q3) is sent as q0, q1, q3, q2. The next
+        # quad must be (v2, v3, v5, v4), sent as v4, v5.
+        k, idx, tri_index = quads[start]
+        r = [(rotation + i) % 4 for i in range(4)]
+        strip_keys = [k[r[0]], k[r[1]], k[r[3]], k[r[2]]]
+        strip_idx = [idx[r[0]], idx[r[1]], idx[r[3]], idx[r[2]]]
+        members = [start]
+        mesh = triangles[tri_index][0]
+        normal_key = normal_keys[tri_index]
+        while True:
+            edge = (strip_keys[-2], strip_keys[-1])
+            found = None
+            for other in quad_edges.get(edge, []):
+                if quad_used[other] or other in members:
+                    continue
+                ok, _, other_tri = quads[other]
+                if triangles[other_tri][0] is not mesh:
+                    continue
+                if normal_keys[other_tri] != normal_key:
+                    continue
+                found = other
+                break
+            if found is None:
+                break
+            ok, oidx, _ = quads[found]
+            e = [i for i in range(4) if (ok[i], ok[(i + 1) % 4]) == edge][0]
+            r2 = (e + 2) % 4
+            r3 = (e + 3) % 4
+            strip_keys.extend([ok[r3], ok[r2]])
+            strip_idx.extend([oidx[r3], oidx[r2]])
+            members.append(found)
+        return members, strip_idx
+
+    quad_used = [False] * len(quads)
+    quad_strips = []
+    single_quads = []
+
+    for index in range(len(quads)):
+        if quad_used[index]:
+            continue
+        best = None
+        for rotation in range(4):
+            members, strip = quad_strip(index, rotation, quad_used)
+            if best is None or len(members) > len(best[0]):
+                best = (members, strip)
+        members, strip = best
+        for m in members:
+            quad_used[m] = True
+        if len(members) > 1:
+            quad_strips.append((index, strip))
+        else:
+            single_quads.append(index)
+
+    # Join the remaining triangles into triangle strips
+    # -------------------------------------------------
+
+    def tri_strip(start, rotation, strip_used):
+        # Triangles are (v0, v1, v2), (v1, v3, v2), (v2, v3, v4)... so the next
+        # triangle uses the last edge in alternating directions.
+        k = keys[start]
+        mesh, tri, _ = triangles[start]
+        r = [(rotation + i) % 3 for i in range(3)]
+        strip_keys = [k[i] for i in r]
+        strip_idx = [tri[i] for i in r]
+        members = [start]
+        while True:
+            if (len(strip_keys) - 2) % 2 == 0:
+                edge = (strip_keys[-2], strip_keys[-1])
+            else:
+                edge = (strip_keys[-1], strip_keys[-2])
+            found = None
+            for other in tri_edges.get(edge, []):
+                if strip_used[other] or other in members:
+                    continue
+                if triangles[other][0] is not mesh:
+                    continue
+                if normal_keys[other] != normal_keys[start]:
+                    continue
+                found = other
+                break
+            if found is None:
+                break
+            ok = keys[found]
+            e = [i for i in range(3) if (ok[i], ok[(i + 1) % 3]) == edge][0]
+            strip_keys.append(ok[(e + 2) % 3])
+            strip_idx.append(triangles[found][1][(e + 2) % 3])
+            members.append(found)
+        return members, strip_idx
+
+    tri_strips = []
+    single_tris = []
+
+    for index in tris_left:
+        if used[index]:
+            continue
+        best = None
+        for rotation in range(3):
+            members, strip = tri_strip(index, rotation, used)
+            if best is None or len(members) > len(best[0]):
+                best = (members, strip)
+        members, strip = best
+        for m in members:
+            used[m] = True
+        if len(members) > 1:
+            tri_strips.append((index, strip))
+        else:
+            single_tris.append(index)
+
+    # Generate list of primitives
+    # ---------------------------
+
+    primitives = []
+
+    if len(single_tris) > 0:
+        primitives.append(("triangles", [triangles[i] for i in single_tris]))
+
+    if len(single_quads) > 0:
+        polys = []
+        for index in single_quads:
+            _, idx, tri_index = quads[index]
+            mesh, _, norm = triangles[tri_index]
+            polys.append((mesh, idx, norm))
+        primitives.append(("quads", polys))
+
+    for index, strip in tri_strips:
+        mesh, _, norm = triangles[index]
+        primitives.append(("triangle_strip", [(mesh, strip, norm)]))
+
+    for index, strip in quad_strips:
+        _, _, tri_index = quads[index]
+        mesh, _, norm = triangles[tri_index]
+        primitives.append(("quad_strip", [(mesh, strip, norm)]))
+
+    return primitives
+
+# Cost in cycles of the geometry engine of the commands that can be removed by
+# sorting the polygons.
+COST_MTX_RESTORE = command_cycles("MTX_RESTORE")
+COST_NORMAL = command_cycles("NORMAL")
+COST_TEXCOORD = command_cycles("TEXCOORD")
+
+def reorder_primitives(primitives, joints, texture_size):
+    """
+    Sorts the polygons of each list of triangles or quads, and the strips, so
+    that consecutive vertices use the same joint, normal and texture coordinates
+    as often as possible. The display list only needs to restore a joint matrix,
+    or to send a normal or texture coordinates, when they change. The vertices
+    of triangles and quads can also be rotated to start with the vertex that
+    matches the previous polygon best, which doesn't change the polygon.
+    """
+    def vertex_state(mesh, index, norm):
+        vert = mesh.verts[index]
+        weight = mesh.weights[vert.startWeight]
+        n = get_joint_space_normal(joints[weight.joint], norm)
+        return (weight.joint,
+                (float_to_n10(n.x), float_to_n10(n.y), float_to_n10(n.z)),
+                (float_to_t16(vert.st[0] * texture_size[0]),
+                 float_to_t16(vert.st[1] * texture_size[1])))
+
+    def vertex_cost(state, v):
+        cost = 0
+        if state is None or state[2] != v[2]:
+            cost += COST_TEXCOORD
+        if state is None or state[0] != v[0]:
+            # Restoring a matrix requires sending the normal again
+            cost += COST_MTX_RESTORE + COST_NORMAL
+        elif state[1] != v[1]:
+            cost += COST_NORMAL
+        return cost
+
+    def get_options(poly_type, mesh, indices, norm, rotate):
+        """
+        Returns the possible ways to send a polygon as a list of tuples of
+        (polygon, first vertex state, last vertex state, cost of the polygon
+        without the first vertex).
+        """
+        indices = list(indices)
+        states = [vertex_state(mesh, i, norm) for i in indices]
+        num_rotations = len(indices) if rotate else 1
+        options = []
+        for r in range(num_rotations):
+            polygon = (poly_type, mesh, indices[r:] + indices[:r], norm)
+            rot_states = states[r:] + states[:r]
+            cost = 0
+            for prev, this in zip(rot_states, rot_states[1:]):
+                cost += vertex_cost(prev, this)
+            options.append((polygon, rot_states[0], rot_states[-1], cost))
+        return options
+
+    def sort_polygons(polygons, state):
+        """
+        Sorts a list of polygons (each one is a list of options) by picking the
+        cheapest polygon after the last one every time. It returns the sorted
+        list of options and the state after the last polygon.
+        """
+        # Only polygons that can start with the current joint are checked,
+        # unless there are none left.
+        by_joint = {}
+        for index, options in enumerate(polygons):
+            for option in options:
+                by_joint.setdefault(option[1][0], set()).add(index)
+
+        remaining = set(range(len(polygons)))
+        result = []
+
+        while len(remaining) > 0:
+            joint = None if state is None else state[0]
+            candidates = by_joint.get(joint, set())
+            if len(candidates) == 0:
+                candidates = remaining
+
+            best = None
+            best_cost = None
+            for index in sorted(candidates):
+                for option in polygons[index]:
+                    cost = vertex_cost(state, option[1]) + option[3]
+                    if best is None or cost < best_cost:
+                        best = (index, option)
+                        best_cost = cost
+
+            index, option = best
+            remaining.remove(index)
+            for o in polygons[index]:
+                by_joint[o[1][0]].discard(index)
+
+            result.append(option)
+            state = option[2]
+
+        return result, state
+
+    result = []
+    strips = []
+    state = None
+
+    for poly_type, polys in primitives:
+        if poly_type in ["triangles", "quads"]:
+            options = [get_options(poly_type, mesh, indices, norm, True)
+                       for mesh, indices, norm in polys]
+            options, state = sort_polygons(options, state)
+            result.append((poly_type, [(mesh, indices, norm)
+                    for (_, mesh, indices, norm), _, _, _ in options]))
+        else:
+            mesh, indices, norm = polys[0]
+            strips.append(get_options(poly_type, mesh, indices, norm, False))
+
+    # The order of the vertices of a strip can't be changed, but the order of
+    # the strips can.
+    options, state = sort_polygons(strips, state)
+    for (poly_type, mesh, indices, norm), _, _, _ in options:
+        result.append((poly_type, [(mesh, indices, norm)]))
+
+    return result
+
+def add_triangles_to_display_list(dl, triangles, joints, texture_size,
+                                  draw_normal_polygons, joint_matrix, strips,
+                                  reorder):
+    """
+    Adds a list of triangles to a display list, grouped in strips and sorted if
+    requested. It returns the number of polygons of each type and the number of
+    vertices.
+    """
+    # Normal polygons are drawn as individual triangles after each triangle of
+    # the model, so they can't be used with strips.
+    if strips and not draw_normal_polygons:
+        primitives = stripify(triangles, joints)
+    else:
+        primitives = [("triangles", triangles)]
+
+    if reorder and not draw_normal_polygons:
+        primitives = reorder_primitives(primitives, joints, texture_size)
+
+    stats = {
+        "triangles": 0,
+        "quads": 0,
+        "triangle_strip": 0,
+        "quad_strip": 0,
+        "vertices": 0,
+    }
+
+    last_joint_index = None
+
+    for poly_type, polys in primitives:
+        if poly_type in ["triangles", "quads"]:
+            dl.switch_vtxs(poly_type)
+            stats[poly_type] += len(polys)
+        else:
+            # Each strip needs its own BEGIN_VTXS
+            if dl.begin_vtx_last is not None:
+                dl.end_vtxs()
+            dl.begin_vtxs(poly_type)
+            stats[poly_type] += 1
+
+        for mesh, tri, norm in polys:
+            stats["vertices"] += len(tri)
+
+            if poly_type == "triangles":
+                last_joint_index = add_triangle_to_display_list(dl, mesh, tri,
+                        norm, joints, texture_size, draw_normal_polygons,
+                        joint_matrix, last_joint_index)
+                continue
+
+            for i in tri:
+                vert = mesh.verts[i]
+                weight = mesh.weights[vert.startWeight]
+                last_joint_index = add_vertex_to_display_list(dl, vert, weight,
+                        norm, joints, texture_size, False, joint_matrix,
+                        last_joint_index)
+
+    dl.end_vtxs()
+
+    return stats
+
+def print_display_list_stats(stats, num_triangles, display_lists):
+    print(f"  Triangles: {stats['triangles']}")
+    print(f"  Quads: {stats['quads']}")
+    print(f"  Triangle strips: {stats['triangle_strip']}")
+    print(f"  Quad strips: {stats['quad_strip']}")
+    print(f"  Vertices: {stats['vertices']} (without strips: {num_triangles * 3})")
+    print_geometry_stats(display_lists)
+
+def print_geometry_stats(display_lists):
+    """
+    Prints the number of polygons, vertices, words and cycles of the geometry
+    engine needed to draw a list of display lists. This is what
+    DSMA_GetModelStats() returns.
+    """
+    polygons = sum(dl.num_polygons for dl in display_lists)
+    vertices = sum(dl.num_vertices for dl in display_lists)
+    words = sum(dl.num_words() for dl in display_lists)
+    cycles = sum(dl.num_cycles for dl in display_lists)
+
+    print(f"  Geometry: {polygons} polygons, {vertices} vertices, "
+          f"{words} words, {cycles} cycles (estimated)")
+
+def print_vertex_report(display_lists):
+    """
+    Prints the number of vertices sent with each command, the size of the
+    commands and the error of the positions, for all the display lists of a
+    DSM file.
+    """
+    counts = { name: 0 for name in VTX_COMMANDS }
+    error_max = 0
+    error_sum = 0
+
+    for dl in display_lists:
+        for name in VTX_COMMANDS:
+            counts[name] += dl.vtx_stats[name]
+        error_max = max(error_max, dl.vtx_error_max)
+        error_sum += dl.vtx_error_sum
+
+    total = sum(counts.values())
+    if total == 0:
+        return
+
+    words = total + counts["VTX_16"]
+
+    print("  Vertex commands: " +
+          ", ".join([f"{name} {counts[name]}" for name in VTX_COMMANDS]))
+    print(f"  Vertex command size: {words} words (only VTX_16: {total * 2} words)")
+    print(f"  Vertex error: max {error_max:.6f}, average {error_sum / total:.6f}")
+
+def get_bind_pose_position(mesh, index, joints):
+    """Returns the position of a vertex of a mesh in the bind pose."""
+    weight = mesh.weights[mesh.verts[index].startWeight]
+    joint = joints[weight.joint]
+    m = joint_info_to_m4x3(joint.orient, joint.pos)
+    return weight.pos.mul_m4x3(m)
+
+def get_triangle_normal(mesh, tri, joints):
+    """Returns the normal of a triangle in the bind pose."""
+    vtx = [get_bind_pose_position(mesh, i, joints) for i in tri]
+
+    a = vtx[0].sub(vtx[1])
+    b = vtx[1].sub(vtx[2])
+
+    n = a.cross(b)
+
+    if n.length() > 0:
+        return n.normalize()
+
+    return Vector(0, 0, 0)
+
+def decimate_triangles(triangles, joints, ratio):
+    """
+    Reduces the number of triangles of a list of (mesh, tri, norm) tuples to
+    the specified ratio by collapsing edges. The vertex with the lowest quadric
+    error (calculated in the bind pose) is moved to one of its neighbours, so no
+    new vertices are created and every vertex keeps its texture coordinates.
+
+    Vertices of a mesh with the same position and joint are welded to find the
+    edges, so texture seams can be simplified. A vertex in a seam can only be
+    moved along the seam, and each side of the seam keeps its own texture
+    coordinates.
+
+    Vertices are only collapsed into vertices assigned to the same joint, so
+    the simplified model is deformed by the skeleton in the same way as the
+    original one. Vertices in the border of a mesh, or in the border between
+    two joints, aren't removed.
+    """
+    # Vertices of the display list are identified by (mesh index, vertex
+    # index). Vertices with the same mesh, joint and position are welded.
+    meshes = []
+    mesh_index = {}
+    for mesh, tri, norm in triangles:
+        if id(mesh) not in mesh_index:
+            mesh_index[id(mesh)] = len(meshes)
+            meshes.append(mesh)
+
+    weld = {}
+    weld_key = {}
+    pos = []
+    joint = []
+
+    tris = []
+    for mesh, tri, norm in triangles:
+        m = mesh_index[id(mesh)]
+        for i in tri:
+            if (m, i) in weld:
+                continue
+            weight = mesh.weights[mesh.verts[i].startWeight]
+            key = (m, weight.joint, weight.pos.x, weight.pos.y, weight.pos.z)
+            if key not in weld_key:
+                weld_key[key] = len(pos)
+                pos.append(get_bind_pose_position(mesh, i, joints))
+                joint.append(weight.joint)
+            weld[(m, i)] = weld_key[key]
+        tris.append([(m, i) for i in tri])
+
+    def welded(tri):
+        return [weld[a] for a in tri]
+
+    def plane_quadric(p0, p1, p2):
+        n = p1.sub(p0).cross(p2.sub(p0))
+        area = n.length()
+        if area == 0:
+            return [0] * 10
+        n = Vector(n.x / area, n.y / area, n.z / area)
+        d = -(n.x * p0.x + n.y * p0.y + n.z * p0.z)
+        # Upper triangle of the 4x4 matrix, weighted by the area
+        plane = [n.x, n.y, n.z, d]
+        return [area * plane[i] * plane[j] for i in range(4) for j in range(i, 4)]
+
+    def quadric_error(q, p):
+        x, y, z = p.x, p.y, p.z
+        return (q[0] * x * x + 2 * q[1] * x * y + 2 * q[2] * x * z + 2 * q[3] * x
+                + q[4] * y * y + 2 * q[5] * y * z + 2 * q[6] * y
+                + q[7] * z * z + 2 * q[8] * z
+                + q[9])
+
+    quadric = [[0] * 10 for p in pos]
+    vert_tris = [set() for p in pos]
+
+    for t, tri in enumerate(tris):
+        w = welded(tri)
+        q = plane_quadric(*[pos[v] for v in w])
+        for v in w:
+            quadric[v] = [a + b for a, b in zip(quadric[v], q)]
+            vert_tris[v].add(t)
+
+    # Edges that aren't used by exactly two triangles are borders
+    edge_count = {}
+    for tri in tris:
+        w = welded(tri)
+        for i in range(3):
+            edge = frozenset((w[i], w[(i + 1) % 3]))
+            edge_count[edge] = edge_count.get(edge, 0) + 1
+
+    locked = set()
+    for edge, count in edge_count.items():
+        if count != 2:
+            locked.update(edge)
+
+    def neighbours(v):
+        result = set()
+        for t in vert_tris[v]:
+            result.update(welded(tris[t]))
+        result.discard(v)
+        return result
+
+    def get_collapse(v, u):
+        """
+        Returns a dictionary that tells which vertex of u replaces each vertex
+        of v, or None if v can't be moved to u.
+        """
+        if v in locked or joint[v] != joint[u]:
+            return None
+
+        shared = vert_tris[v] & vert_tris[u]
+        if len(shared) != 2:
+            return None
+
+        # Only the two vertices opposite to the edge can be shared, or the
+        # mesh would stop being a manifold
+        if len(neighbours(v) & neighbours(u)) != 2:
+            return None
+
+        # Each vertex of v must be connected to exactly one vertex of u. If
+        # not, v is in a seam that doesn't go along the edge.
+        replace = {}
+        for t in vert_tris[v]:
+            for a in tris[t]:
+                if weld[a] == v:
+                    replace.setdefault(a, set())
+        for a in replace:
+            for t in vert_tris[v] & vert_tris[u]:
+                if a in tris[t]:
+                    replace[a].update(b for b in tris[t] if weld[b] == u)
+            if len(replace[a]) != 1:
+                return None
+            replace[a] = replace[a].pop()
+
+        # Triangles that aren't removed must not flip or become degenerate
+        for t in vert_tris[v] - shared:
+            w = welded(tris[t])
+            old = [pos[x] for x in w]
+            new = [pos[u] if x == v else pos[x] for x in w]
+            n_old = old[1].sub(old[0]).cross(old[2].sub(old[0]))
+            n_new = new[1].sub(new[0]).cross(new[2].sub(new[0]))
+            if n_new.length() == 0:
+                return None
+            dot = n_old.x * n_new.x + n_old.y * n_new.y + n_old.z * n_new.z
+            if dot <= 0.2 * n_old.length() * n_new.length():
+                return None
+
+        return replace
+
+    version = [0] * len(pos)
+    heap = []
+
+    def push_edges(v):
+        for u in neighbours(v):
+            for a, b in [(v, u), (u, v)]:
+                if a in locked or joint[a] != joint[b]:
+                    continue
+                q = [x + y for x, y in zip(quadric[a], quadric[b])]
+                cost = quadric_error(q, pos[b])
+                heapq.heappush(heap, (cost, a, b, version[a], version[b]))
+
+    for v in range(len(pos)):
+        push_edges(v)
+
+    alive = set(range(len(tris)))
+    target = max(1, int(round(len(tris) * ratio)))
+
+    while len(alive) > target and len(heap) > 0:
+        cost, v, u, version_v, version_u = heapq.heappop(heap)
+
+        if version[v] != version_v or version[u] != version_u:
+            continue
+        if u not in neighbours(v):
+            continue
+
+        replace = get_collapse(v, u)
+        if replace is None:
+            continue
+
+        # Move v to u and remove the triangles that used both of them
+        for t in vert_tris[v]:
+            w = welded(tris[t])
+            if u in w:
+                alive.discard(t)
+                for x in w:
+                    if x != v:
+                        vert_tris[x].discard(t)
+            else:
+                tris[t] = [replace.get(a, a) for a in tris[t]]
+                vert_tris[u].add(t)
+        vert_tris[v] = set()
+
+        quadric[u] = [a + b for a, b in zip(quadric[u], quadric[v])]
+
+        changed = neighbours(u) | { u }
+        for w in changed:
+            version[w] += 1
+        for w in changed:
+            push_edges(w)
+
+    result = []
+    for t in sorted(alive):
+        mesh = meshes[tris[t][0][0]]
+        tri = tuple(a[1] for a in tris[t])
+        result.append((mesh, tri, get_triangle_normal(mesh, tri, joints)))
+
+    print(f"  Triangles: {len(result)} (original: {len(triangles)})")
+
+    return result
+
+def get_triangle_joints(mesh, tri):
+    """Returns the set of joints used by the vertices of a triangle."""
+    return frozenset(mesh.weights[mesh.verts[i].startWeight].joint for i in tri)
+
+def split_in_segments(triangles, segment_size):
+    """
+    Splits a list of (mesh, tri, norm) tuples into segments that use up to
+    'segment_size' joints each. It returns a list of segments. Each segment is a
+    tuple with the list of joints that have to be loaded to the stack before
+    drawing it (as (slot, joint) tuples), a list with the joint held by each
+    slot of the stack, and the list of triangles of the segment.
+
+    Triangles that use the same joints are drawn together, and joints already
+    loaded in the stack by previous segments are reused when possible, so that
+    the number of joints that need to be loaded is as small as possible.
+    """
+    groups = {}
+    for t in triangles:
+        key = get_triangle_joints(t[0], t[1])
+        if len(key) > segment_size:
+            raise Exception(f"A triangle uses {len(key)} joints, but segments "
+                            f"can only use {segment_size}")
+        groups.setdefault(key, []).append(t)
+
+    # Keep the original order of the groups to make the output predictable
+    remaining = list(groups.keys())
+
+    slots = [None] * segment_size
+    segments = []
+
+    while len(remaining) > 0:
+        needed = set()
+        chosen = []
+
+        while True:
+            best = None
+            best_score = None
+            for key in remaining:
+                new = key - needed
+                if len(needed) + len(new) > segment_size:
+                    continue
+                # Prefer groups that don't need to load new joints, then groups
+                # that use few joints, then groups with many triangles.
+                loads = len([j for j in new if j not in slots])
+                score = (loads, len(new), -len(groups[key]))
+                if best is None or score < best_score:
+                    best = key
+                    best_score = score
+
+            if best is None:
+                break
+
+            needed |= best
+            chosen.append(best)
+            remaining.remove(best)
+
+        # Joints that are already in the stack stay in the same slot. New
+        # joints replace joints that this segment doesn't need.
+        loads = []
+        for joint in sorted(needed):
+            if joint in slots:
+                continue
+            if None in slots:
+                slot = slots.index(None)
+            else:
+                slot = [i for i, j in enumerate(slots) if j not in needed][0]
+            slots[slot] = joint
+            loads.append((slot, joint))
+
+        tris = []
+        for key in chosen:
+            tris.extend(groups[key])
+
+        segments.append((loads, list(slots), tris))
+
+    return segments
+
+DSM_SEGMENTED_MAGIC = 0x4D534453 # "SDSM"
+
+def save_segmented_model(triangles, output_file, joints, texture_size,
+                         draw_normal_polygons, segment_size, strips, reorder,
+                         max_vtx_error):
+    """
+    Saves a DSM file with the triangles split in segments, each one using at
+    most 'segment_size' joints. This is needed for skeletons that don't fit in
+    the matrix stack.
+    """
+    segments = split_in_segments(triangles, segment_size)
+
+    base_matrix = 30 - segment_size + 1
+
+    # Header: magic, number of segments, segment size, number of joints, and
+    # the offset to each segment.
+    u32_array = [DSM_SEGMENTED_MAGIC, len(segments), segment_size, len(joints)]
+    u32_array.extend([0] * len(segments))
+
+    total_loads = 0
+    total_stats = {}
+    display_lists = []
+
+    for index, (loads, slots, tris) in enumerate(segments):
+        u32_array[4 + index] = len(u32_array) * 4
+
+        # Each load is a (slot, joint) pair of bytes
+        u32_array.append(len(loads))
+        u16_array = [slot | (joint << 8) for slot, joint in loads]
+        u32_array.extend(u16_array_to_u32_array(u16_array))
+
+        total_loads += len(loads)
+
+        dl = DisplayList(max_vtx_error)
+        display_lists.append(dl)
+
+        joint_matrix = {}
+        for slot, joint in enumerate(slots):
+            if joint is not None:
+                joint_matrix[joint] = base_matrix + slot
+
+        # Strips are generated per segment, so they never need a joint that
+        # isn't loaded in the matrix stack.
+        stats = add_triangles_to_display_list(dl, tris, joints, texture_size,
+                draw_normal_polygons, joint_matrix, strips, reorder)
+        for key in stats:
+            total_stats[key] = total_stats.get(key, 0) + stats[key]
+
+        dl.finalize()
+
+        u32_array.extend(dl.display_list)
+
+    print(f"  Segments: {len(segments)}")
+    print(f"  Joint loads: {total_loads} (skeleton: {len(joints)} joints)")
+    print_display_list_stats(total_stats, len(triangles), display_lists)
+    print_vertex_report(display_lists)
+
+    save_u32_array(u32_array, output_file)
+
 def convert_md5mesh(model_file, name, output_folder, texture_size,
                     draw_normal_polygons, extension_mesh, extension_anim,
-                    blender_fix, export_base_pose):
+                    blender_fix, export_base_pose, compact, segment_size,
+                    strips, reorder, max_vtx_error, lods):
 
     print(f"Converting model: {model_file}")
 
@@ -606,21 +1973,20 @@ def convert_md5mesh(model_file, name, output_folder, texture_size,
               "texture. If you want them to have different textures, you must use "
               "multiple .md5mesh files.")
 
+    # List of files generated by this function
+    output_files = []
+
     if export_base_pose:
         print("Converting base pose...")
 
-        save_animation([joints],
-                       os.path.join(output_folder, f"{name}{extension_anim}"),
-                       blender_fix)
+        output_file = os.path.join(output_folder, f"{name}{extension_anim}")
+        save_animation([joints], output_file, blender_fix, compact)
+        output_files.append(output_file)
 
     print("Converting meshes...")
 
-    # Display list shared between all meshes
-    dl = DisplayList()
-    dl.switch_vtxs("triangles")
-
-    base_matrix = 30 - len(joints) + 1
-    last_joint_index = None
+    # List of triangles of all meshes with their normals
+    triangles = []
 
     for mesh in meshes:
         print(f"  Vertices: {mesh.numverts}")
@@ -629,145 +1995,403 @@ def convert_md5mesh(model_file, name, output_folder, texture_size,
 
         print("  Generating per-triangle normals...")
 
-        tri_normal = []
-        for tri in mesh.tris:
-            verts = [mesh.verts[i] for i in tri]
-            weights = [mesh.weights[v.startWeight] for v in verts]
+        tri_normal = [get_triangle_normal(mesh, tri, joints) for tri in mesh.tris]
 
-            vtx = []
-            for vert, weight in zip(verts, weights):
-                joint = joints[weight.joint]
-                m = joint_info_to_m4x3(joint.orient, joint.pos)
-                final = weight.pos.mul_m4x3(m)
-                vtx.append(final)
+        triangles.extend(zip([mesh] * len(mesh.tris), mesh.tris, tri_normal))
 
-            a = vtx[0].sub(vtx[1])
-            b = vtx[1].sub(vtx[2])
+    if segment_size is not None:
+        if segment_size < 3 or segment_size > 30:
+            raise Exception("The segment size must be between 3 and 30 joints")
+    elif len(joints) > 30:
+        raise Exception(f"The skeleton has {len(joints)} joints, but only 30 fit "
+                        "in the matrix stack. Use --segment-size.")
 
-            n = a.cross(b)
+    for level, ratio in enumerate([1.0] + lods):
+        if level == 0:
+            output_file = os.path.join(output_folder, f"{name}{extension_mesh}")
+            level_triangles = triangles
+        else:
+            if ratio <= 0 or ratio >= 1:
+                raise Exception("The ratios of the levels of detail must be "
+                                "between 0.0 and 1.0")
 
-            if n.length() > 0:
-                n = n.normalize()
-                tri_normal.append(n)
-            else:
-                tri_normal.append(Vector(0, 0, 0))
+            output_file = os.path.join(output_folder,
+                                       f"{name}_lod{level}{extension_mesh}")
 
-        print("  Generating display list...")
+            print(f"Generating level of detail {level} ({ratio * 100:.0f}% of triangles)...")
+            level_triangles = decimate_triangles(triangles, joints, ratio)
 
-        for tri, norm in zip(mesh.tris, tri_normal):
-            verts = [mesh.verts[i] for i in tri]
-            weights = [mesh.weights[v.startWeight] for v in verts]
+        output_files.append(output_file)
 
-            finals = []
+        print("Generating display list...")
 
-            for vert, weight in zip(verts, weights):
+        if segment_size is not None:
+            save_segmented_model(level_triangles, output_file, joints,
+                                 texture_size, draw_normal_polygons,
+                                 segment_size, strips, reorder, max_vtx_error)
+            continue
 
-                # Texture
-                # -------
+        # Display list shared between all meshes
+        dl = DisplayList(max_vtx_error)
 
-                st = vert.st
-                # In the MD5 format (0, 0) is the top-left corner, same as what
-                # the GPU of the DS expects.
-                u = st[0] * texture_size[0]
-                v = st[1] * texture_size[1]
-                dl.texcoord(u, v)
+        base_matrix = 30 - len(joints) + 1
+        joint_matrix = [base_matrix + i for i in range(len(joints))]
 
-                # Vertex and normal
-                # -----------------
+        stats = add_triangles_to_display_list(dl, level_triangles, joints,
+                texture_size, draw_normal_polygons, joint_matrix, strips,
+                reorder)
 
-                # Load joint matrix. When drawing normal polygons it has to be
-                # loaded every time, because drawing the normal restores the
-                # original matrix.
+        dl.finalize()
 
-                joint_index = weight.joint
-                if draw_normal_polygons or joint_index != last_joint_index:
-                    dl.mtx_restore(base_matrix + joint_index)
-                    last_joint_index = joint_index
+        print_display_list_stats(stats, len(level_triangles), [dl])
+        print_vertex_report([dl])
 
-                # Calculate normal in joint space
+        dl.save_to_file(output_file)
 
-                joint = joints[joint_index]
+    return output_files
 
-                q = joint.orient
-                qt = q.complement()
-                n = norm.to_q()
+DSM_BAKED_MAGIC = 0x4D534442 # "BDSM"
 
-                # Transform by the inverted quaternion
-                n = qt.mul(n).mul(q).to_v3()
+def bake_md5anim(model_file, name, output_folder, anim_file, texture_size,
+                 skip_frames, resample_rate, extension_mesh, blender_fix,
+                 max_vtx_error):
+    """
+    Saves a DSM file with one display list per frame of the animation. Each
+    display list contains the model already deformed by the skeleton, so it
+    can be drawn without calculating any joint matrix.
+    """
+    print(f"Baking animation: {anim_file}")
+
+    _, meshes = parse_md5mesh(model_file)
+    frames, frame_rate = parse_md5anim(anim_file)
+
+    # Create name of animation based on file name
+    file_basename = os.path.basename(anim_file).replace(".md5anim", "")
+    anim_name = file_basename.replace(".", "_").lower()
+
+    frames = select_frames(frames, frame_rate, skip_frames, resample_rate)
+
+    # Header: magic, number of frames and the offset to each frame. The number
+    # of frames is in the same place as in DSA files.
+    u32_array = [DSM_BAKED_MAGIC, len(frames)]
+    u32_array.extend([0] * len(frames))
+
+    # Display lists that have already been saved, and their offsets
+    saved_lists = {}
+    display_lists = []
+
+    for index, frame in enumerate(frames):
+        matrices = []
+        for joint in frame:
+            this_pos, this_orient = fix_joint_orientation(joint, blender_fix)
+            matrices.append(joint_info_to_m4x3(this_orient, this_pos))
+
+        dl = DisplayList(max_vtx_error)
+        dl.switch_vtxs("triangles")
+
+        for mesh in meshes:
+            for tri in mesh.tris:
+                verts = [mesh.verts[i] for i in tri]
+                weights = [mesh.weights[v.startWeight] for v in verts]
+
+                vtx = [w.pos.mul_m4x3(matrices[w.joint]) for w in weights]
+
+                # The model is deformed, so the normal needs to be calculated
+                # for each frame.
+                a = vtx[0].sub(vtx[1])
+                b = vtx[1].sub(vtx[2])
+
+                n = a.cross(b)
                 if n.length() > 0:
                     n = n.normalize()
-                dl.normal(n.x, n.y, n.z)
 
-                # The vertex is already in joint space
+                for vert, v in zip(verts, vtx):
+                    st = vert.st
+                    dl.texcoord(st[0] * texture_size[0], st[1] * texture_size[1])
+                    dl.normal(n.x, n.y, n.z)
+                    dl.vtx(v.x, v.y, v.z)
 
-                dl.vtx(weight.pos.x, weight.pos.y, weight.pos.z)
+        dl.end_vtxs()
+        dl.finalize()
 
-                if draw_normal_polygons:
-                    # Calculate actual location of the vertex so that the
-                    # vertices of the triangle can be averaged as origin of the
-                    # normal polygon.
-                    q = joint.orient
-                    qt = q.complement()
-                    v = weight.pos.to_q()
+        # Frames that are identical to a previous frame share its display list
+        key = tuple(dl.display_list)
+        if key not in saved_lists:
+            saved_lists[key] = len(u32_array) * 4
+            u32_array.extend(dl.display_list)
+            display_lists.append(dl)
 
-                    delta = q.mul(v).mul(qt).to_v3()
+        u32_array[2 + index] = saved_lists[key]
 
-                    final = joint.pos.add(delta)
-                    finals.append(final)
+    print(f"  Frames: {len(frames)} ({len(saved_lists)} unique)")
+    print(f"  Size: {len(u32_array) * 4} bytes")
+    print_vertex_report(display_lists)
 
-            if draw_normal_polygons:
+    # Only one frame is drawn at a time, report the slowest one
+    slowest = max(display_lists, key=lambda dl: dl.num_cycles)
+    print_geometry_stats([slowest])
 
-                # Don't use any of the joint transformation matrices
-                dl.mtx_restore(1)
+    output_file = os.path.join(output_folder,
+                               f"{name}_{anim_name}_baked{extension_mesh}")
+    save_u32_array(u32_array, output_file)
 
-                vert_avg = Vector(
-                    (finals[0].x + finals[1].x + finals[2].x) / 3,
-                    (finals[0].y + finals[1].y + finals[2].y) / 3,
-                    (finals[0].z + finals[1].z + finals[2].z) / 3
-                )
+    return output_file
 
-                vert_avg_end = vert_avg.add(norm)
+DSA_BOUNDS_MAGIC = 0x42415344 # "DSAB"
 
-                dl.texcoord(0, 0)
+# Max shift of the boxes of a bounds file (the number of fractional bits of the
+# scale factors used by the library).
+DSA_BOUNDS_MAX_SHIFT = 12
 
-                dl.color(1, 0, 0)
-                dl.vtx(vert_avg.x + 0.1, vert_avg.y, vert_avg.z)
-                dl.vtx(vert_avg.x, vert_avg.y, vert_avg.z)
-                dl.color(0, 1, 0)
-                dl.vtx(vert_avg_end.x, vert_avg_end.y, vert_avg_end.z)
+# Number of steps between two frames of an animation where the model is sampled
+# to calculate its bounding box.
+BOUNDS_STEPS = 4
 
-                dl.color(1, 0, 0)
-                dl.vtx(vert_avg.x, vert_avg.y, vert_avg.z)
-                dl.vtx(vert_avg.x, vert_avg.y + 0.1, vert_avg.z)
-                dl.color(0, 1, 0)
-                dl.vtx(vert_avg_end.x, vert_avg_end.y, vert_avg_end.z)
+# Margin added to each side of a bounding box, relative to its biggest side. It
+# covers the error of the fixed point math of the library and the positions
+# between the sampled ones.
+BOUNDS_MARGIN = 0.02
 
-                dl.color(1, 0, 0)
-                dl.vtx(vert_avg.x, vert_avg.y, vert_avg.z)
-                dl.vtx(vert_avg.x, vert_avg.y, vert_avg.z + 0.1)
-                dl.color(0, 1, 0)
-                dl.vtx(vert_avg_end.x, vert_avg_end.y, vert_avg_end.z)
-
-    dl.end_vtxs()
-    dl.finalize()
+def save_bounds(model_file, name, output_folder, anim_file, skip_frames,
+                resample_rate, extension_bounds, blender_fix):
+    """
+    Saves a file with the bounding box of the model for each frame of the
+    animation, in the format used by the BOX_TEST command. The box of a frame
+    contains the model at all the points between that frame and the next one,
+    so that it can be used with any fractional frame.
+    """
+    print(f"Calculating bounding boxes: {anim_file}")
 
-    dl.save_to_file(os.path.join(output_folder, f"{name}{extension_mesh}"))
+    _, meshes = parse_md5mesh(model_file)
+    frames, frame_rate = parse_md5anim(anim_file)
 
+    # Create name of animation based on file name
+    file_basename = os.path.basename(anim_file).replace(".md5anim", "")
+    anim_name = file_basename.replace(".", "_").lower()
 
-def convert_md5anim(name, output_folder, anim_file, skip_frames, extension_anim,
-                    blender_fix):
+    frames = select_frames(frames, frame_rate, skip_frames, resample_rate)
+    frames = [[fix_joint_orientation(joint, blender_fix) for joint in frame]
+              for frame in frames]
+    frames = make_quaternions_continuous(frames)
+
+    weights = [mesh.weights[vert.startWeight]
+               for mesh in meshes for vert in mesh.verts]
+
+    boxes = []
+
+    for index, frame in enumerate(frames):
+        # Animations loop, so the last frame is interpolated with the first one
+        next_frame = frames[(index + 1) % len(frames)]
+
+        box_min = [float("inf")] * 3
+        box_max = [float("-inf")] * 3
+
+        # The box must be valid with both interpolation quality modes of the
+        # library, with and without normalization.
+        for step, normalize in product(range(BOUNDS_STEPS + 1), (False, True)):
+            t = step / BOUNDS_STEPS
+
+            matrices = []
+            for a, b in zip(frame, next_frame):
+                pos, orient = interpolate_joint(a, b, t, normalize)
+                matrices.append(joint_info_to_m4x3(orient, pos))
+
+            for w in weights:
+                v = w.pos.mul_m4x3(matrices[w.joint])
+                for i, coord in enumerate((v.x, v.y, v.z)):
+                    box_min[i] = min(box_min[i], coord)
+                    box_max[i] = max(box_max[i], coord)
+
+        margin = max(box_max[i] - box_min[i] for i in range(3)) * BOUNDS_MARGIN
+        boxes.append(([v - margin for v in box_min], [v + margin for v in box_max]))
+
+    # BOX_TEST only accepts 16-bit values. Models can be bigger than that when
+    # they are animated, so the boxes are scaled down by a power of two, and the
+    # library scales the matrix up before the test.
+    def box_to_fixed(box_min, box_max, shift):
+        # Round the box outwards
+        start = [floor(v * (1 << 12)) >> shift for v in box_min]
+        end = [-(floor(-v * (1 << 12)) >> shift) for v in box_max]
+        size = [e - s for s, e in zip(start, end)]
+        return start + size
+
+    pos_shift = 0
+    while True:
+        fixed_boxes = [box_to_fixed(box_min, box_max, pos_shift)
+                       for box_min, box_max in boxes]
+        if all(-0x8000 <= v <= 0x7FFF for box in fixed_boxes for v in box):
+            break
+        pos_shift += 1
+        # The library scales the matrix back down by 1.0 >> pos_shift, which
+        # must not be truncated.
+        if pos_shift > DSA_BOUNDS_MAX_SHIFT:
+            raise Exception("The model is too big for a bounds file")
+
+    # Header: magic and number of frames (in the same place as in DSA files),
+    # and the shift of the boxes. Each box is stored as the 3 parameters of
+    # BOX_TEST: x and y, z and width, height and depth.
+    u32_array = [DSA_BOUNDS_MAGIC, len(frames), pos_shift]
+
+    u16_array = [v & 0xFFFF for box in fixed_boxes for v in box]
+    u32_array.extend(u16_array_to_u32_array(u16_array))
+
+    box_size_max = max(max(box[3:]) for box in fixed_boxes) * (1 << pos_shift)
+
+    print(f"  Frames: {len(frames)}")
+    print(f"  Max box size: {box_size_max / (1 << 12):.3f} (shift: {pos_shift})")
+
+    output_file = os.path.join(output_folder,
+                               f"{name}_{anim_name}{extension_bounds}")
+    save_u32_array(u32_array, output_file)
+
+    return output_file
+
+def convert_md5anim(name, output_folder, anim_file, skip_frames, resample_rate,
+                    extension_anim, blender_fix, compact, keyframe_tolerance,
+                    matrices, snap_frames):
 
     print(f"Converting animation: {anim_file}")
 
-    frames = parse_md5anim(anim_file)
+    frames, frame_rate = parse_md5anim(anim_file)
 
     # Create name of animation based on file name
     file_basename = os.path.basename(anim_file).replace(".md5anim", "")
     anim_name = file_basename.replace(".", "_").lower()
 
-    frames = frames[::skip_frames+1]
-    save_animation(frames, os.path.join(output_folder,
-                   f"{name}_{anim_name}{extension_anim}"), blender_fix)
+    frames = select_frames(frames, frame_rate, skip_frames, resample_rate)
+    output_file = os.path.join(output_folder, f"{name}_{anim_name}{extension_anim}")
+    save_animation(frames, output_file, blender_fix, compact, keyframe_tolerance,
+                   matrices, snap_frames)
+
+    return output_file
+
+DSMA_CONTAINER_MAGIC = 0x434D5344 # "DSMC"
+
+def name_hash(name):
+    """
+    32-bit FNV-1a hash of a name, the same as DSMA_HashName().
+    """
+    h = 0x811C9DC5
+    for c in name.encode("utf-8"):
+        h ^= c
+        h = (h * 0x01000193) & 0xFFFFFFFF
+    return h
+
+def load_u32_array(input_file):
+    with open(input_file, "rb") as f:
+        data = f.read()
+
+    if len(data) % 4 != 0:
+        raise Exception(f"The size of {input_file} isn't a multiple of 4 bytes")
+
+    return [int.from_bytes(data[i:i + 4], "little")
+            for i in range(0, len(data), 4)]
+
+def get_container_name(input_file):
+    """
+    Returns the name used to look up a file in a container. Files generated with
+    --bin get the same name as the ones generated without it.
+    """
+    name = os.path.basename(input_file)
+    for ext in ["dsm", "dsa", "dsb"]:
+        if name.endswith(f"_{ext}.bin"):
+            name = name[:-len(f"_{ext}.bin")] + f".{ext}"
+    return name
+
+def save_container(input_files, output_file):
+    """
+    Saves a container file with all the provided DSM and DSA files. Files with
+    the same contents are only stored once. The tracks of DSA files with tracks
+    (version 3) are moved to the end of the container so that identical tracks
+    can be shared by different animations.
+    """
+    print(f"Generating container: {output_file}")
+
+    files = {}
+    hashes = {}
+    for input_file in input_files:
+        name = get_container_name(input_file)
+        if name in files:
+            raise Exception(f"Two files have the same name in the container: {name}")
+        h = name_hash(name)
+        if h in hashes:
+            raise Exception(f"Hash collision between {name} and {hashes[h]}")
+        hashes[h] = name
+        files[name] = load_u32_array(input_file)
+
+    names = sorted(files.keys(), key=name_hash)
+
+    # Header: magic, number of files and the index (name hash and offset of
+    # each file).
+    u32_array = [DSMA_CONTAINER_MAGIC, len(names)]
+    u32_array.extend([0] * (len(names) * 2))
+
+    # Offset of each file that has already been saved
+    saved_files = {}
+    # Tracks of DSA files with tracks that have to be saved at the end, as a
+    # list of (index of the offset of the track, offset of the DSA, track)
+    pending_tracks = []
+
+    input_size = 0
+
+    for index, name in enumerate(names):
+        data = files[name]
+        input_size += len(data) * 4
+
+        key = tuple(data)
+        if key not in saved_files:
+            saved_files[key] = len(u32_array) * 4
+
+            # The first word of a DSM file is the size of its display list, so
+            # it can look like the version of a DSA file. Check the name first.
+            if name.endswith(".dsa") and len(data) >= 4 and (data[0] & 0xFF) == 3:
+                # DSA file with tracks. Only the header and the list of tracks
+                # are stored here.
+                num_joints = data[2]
+                pos_shift = data[3]
+                header_size = 4 + num_joints * 2
+                dsa_offset = len(u32_array) * 4
+
+                u32_array.extend(data[:header_size])
+
+                for joint in range(num_joints):
+                    num_keys = data[4 + joint * 2] & 0xFFFF
+                    start = data[4 + joint * 2 + 1] // 4
+                    # Keys, followed by 14 bytes per key, padded to 4 bytes
+                    size = num_keys + ((num_keys * 7 + 1) // 2)
+                    track = data[start:start + size]
+                    if num_keys == 1:
+                        # The span of the key depends on the number of frames
+                        # of the animation, but it isn't used if there is only
+                        # one key. Clear it so that static joints can be shared
+                        # by animations with different lengths.
+                        track = [track[0] & 0xFFFF] + track[1:]
+                    track = (pos_shift, tuple(track))
+                    pending_tracks.append((dsa_offset + (4 + joint * 2 + 1) * 4,
+                                           dsa_offset, track))
+            else:
+                u32_array.extend(data)
+
+        u32_array[2 + index * 2] = name_hash(name)
+        u32_array[2 + index * 2 + 1] = saved_files[key]
+
+    saved_tracks = {}
+    num_tracks = 0
+
+    for offset_index, dsa_offset, track in pending_tracks:
+        num_tracks += 1
+        if track not in saved_tracks:
+            saved_tracks[track] = len(u32_array) * 4
+            u32_array.extend(track[1])
+
+        u32_array[offset_index // 4] = saved_tracks[track] - dsa_offset
+
+    print(f"  Files: {len(names)} ({len(saved_files)} unique)")
+    if num_tracks > 0:
+        print(f"  Tracks: {num_tracks} ({len(saved_tracks)} unique)")
+    print(f"  Size: {len(u32_array) * 4} bytes (files: {input_size} bytes)")
+
+    save_u32_array(u32_array, output_file)
 
 
 if __name__ == "__main__":
@@ -811,12 +2435,79 @@ if __name__ == "__main__":
     parser.add_argument("--skip-frames", required=False,
                         default=0, type=int,
                         help="number of frames to skip in an animation (0 = export all, 1 = export half, 2 = export 33%, etc)")
+    parser.add_argument("--resample", required=False,
+                        default=None, type=float,
+                        help="resample animations to this number of frames per second (for example, the frame rate of the game) instead of using --skip-frames")
+    parser.add_argument("--snap-frames", required=False,
+                        action='store_true',
+                        help="mark animations so that the library rounds frames to the nearest integer instead of interpolating them (useful with --resample)")
+    parser.add_argument("--compact", required=False,
+                        action='store_true',
+                        help="export animations in the compact DSA format (version 2)")
+    parser.add_argument("--keyframe-tolerance", required=False,
+                        default=None, type=float,
+                        help="export animations with one track of keyframes per joint (DSA version 3), removing keyframes that can be interpolated with an error under this value")
+    parser.add_argument("--matrices", required=False,
+                        action='store_true',
+                        help="export animations with the final matrix of each joint in each frame (DSA version 4), which are drawn without any quaternion math")
+    parser.add_argument("--segment-size", required=False,
+                        default=None, type=int,
+                        help="split the model in segments that use up to this number of joints (3 to 30), for skeletons that don't fit in the matrix stack")
+    parser.add_argument("--bake", required=False,
+                        action='store_true',
+                        help="also export one DSM file per animation with all its frames deformed in advance (it requires --model)")
+    parser.add_argument("--bounds", required=False,
+                        action='store_true',
+                        help="also export one file per animation with the bounding box of the model in each frame, for DSMA_TestBounds() (it requires --model)")
+    parser.add_argument("--strips", required=False,
+                        action='store_true',
+                        help="join triangles into quads, triangle strips and quad strips to reduce the number of vertices")
+    parser.add_argument("--reorder-polygons", required=False,
+                        action='store_true',
+                        help="sort polygons to reduce the number of joint matrix, normal and texture coordinate commands")
+    parser.add_argument("--max-vertex-error", required=False,
+                        default=None, type=float,
+                        help="max error allowed in the position of a vertex to use commands smaller than VTX_16 (by default, only commands as accurate as VTX_16 are used)")
+    parser.add_argument("--lod", required=False, type=float, default=[],
+                        nargs="+", action="extend",
+                        help="also export simplified versions of the model with these ratios of triangles (e.g. '--lod 0.5 0.25' exports name_lod1.dsm with half the triangles and name_lod2.dsm with a quarter)")
+    parser.add_argument("--container", required=False,
+                        action='store_true',
+                        help="also pack all the generated files in a container file")
+    parser.add_argument("--container-include", required=False, type=str,
+                        default=[], nargs="+", action="extend",
+                        help="list of additional DSM and DSA files to add to the container (for example, files of other models)")
     parser.add_argument("--draw-normal-polygons", required=False,
                         action='store_true',
                         help="draw polygons with the shape of normals for debugging")
 
     args = parser.parse_args()
 
+    if args.bake and args.model is None:
+        print("The --bake argument requires a model (--model)")
+        sys.exit(1)
+
+    if args.bounds and args.model is None:
+        print("The --bounds argument requires a model (--model)")
+        sys.exit(1)
+
+    if args.resample is not None:
+        if args.resample <= 0:
+            print("The --resample argument must be a positive number")
+            sys.exit(1)
+        if args.skip_frames != 0:
+            print("The --resample argument can't be used with --skip-frames")
+            sys.exit(1)
+
+    if args.matrices and (args.compact or args.keyframe_tolerance is not None):
+        print("The --matrices argument can't be used with --compact or --keyframe-tolerance")
+        sys.exit(1)
+
+    if args.matrices and not args.snap_frames:
+        print("WARNING: The matrices of --matrices are interpolated linearly between "
+              "frames, which deforms the model. Use --snap-frames or only draw "
+              "integer frames.")
+
     if args.model is not None:
         if len(args.texture) != 2:
             print("Please, provide exactly 2 values to the --texture argument")
@@ -836,17 +2527,43 @@ if __name__ == "__main__":
     # Add '.bin' to the name of the files if requested
     extension_mesh = "_dsm.bin" if args.bin else ".dsm"
     extension_anim = "_dsa.bin" if args.bin else ".dsa"
+    extension_bounds = "_dsb.bin" if args.bin else ".dsb"
+    extension_container = "_dsmc.bin" if args.bin else ".dsmc"
+
+    # Files that have been generated, to be added to the container
+    output_files = []
 
     try:
         if args.model is not None:
-            convert_md5mesh(args.model, args.name, args.output, args.texture,
+            output_files += convert_md5mesh(args.model, args.name, args.output, args.texture,
                             args.draw_normal_polygons, extension_mesh,
                             extension_anim, args.blender_fix,
-                            args.export_base_pose)
+                            args.export_base_pose, args.compact,
+                            args.segment_size, args.strips,
+                            args.reorder_polygons, args.max_vertex_error,
+                            args.lod)
 
         for anim_file in args.anims:
-            convert_md5anim(args.name, args.output, anim_file, args.skip_frames,
-                            extension_anim, args.blender_fix)
+            output_files.append(convert_md5anim(args.name, args.output, anim_file, args.skip_frames,
+                            args.resample, extension_anim, args.blender_fix,
+                            args.compact, args.keyframe_tolerance, args.matrices,
+                            args.snap_frames))
+
+            if args.bake:
+                output_files.append(bake_md5anim(args.model, args.name,
+                        args.output, anim_file, args.texture, args.skip_frames,
+                        args.resample, extension_mesh, args.blender_fix,
+                        args.max_vertex_error))
+
+            if args.bounds:
+                output_files.append(save_bounds(args.model, args.name,
+                        args.output, anim_file, args.skip_frames, args.resample,
+                        extension_bounds, args.blender_fix))
+
+        if args.container:
+            save_container(output_files + args.container_include,
+                           os.path.join(args.output,
+                                        f"{args.name}{extension_container}"))
 
     except BaseException as e:
         print("ERROR: " + str(e))